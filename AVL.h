@@ -0,0 +1,49 @@
+#pragma once
+
+#include "AVLInterface.h"
+#include "AVLTree.h"
+
+// `AVLAdapter` wraps any tree with the static `AVLTreeBase` contract in an
+// `AVLInterface`, so it can be handed to code that only knows about the
+// virtual interface (for example `tests.cpp` and `printing.h`). Hot loops
+// that don't need the indirection should use the wrapped tree directly.
+template <typename Tree>
+class AVLAdapter : public AVLInterface {
+public:
+    Node *getRootNode() const override {
+        return tree.getRootNode();
+    }
+
+    bool insert(int data) override {
+        return tree.insert(data);
+    }
+
+    bool remove(int data) override {
+        return tree.remove(data);
+    }
+
+    bool contains(int data) const override {
+        return tree.contains(data);
+    }
+
+    void clear() override {
+        tree.clear();
+    }
+
+    int size() const override {
+        return tree.size();
+    }
+
+    Tree &static_tree() {
+        return tree;
+    }
+
+    const Tree &static_tree() const {
+        return tree;
+    }
+
+private:
+    Tree tree;
+};
+
+class AVL : public AVLAdapter<AVLTree> {};
@@ -0,0 +1,868 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "LookupCache.h"
+#include "Node.h"
+#include "NodePool.h"
+#include "parallel.h"
+
+// The orders `compact` can lay nodes out in. `InOrder` puts each node right
+// after its in-order predecessor, which suits range scans. `VanEmdeBoas`
+// recursively stores the top half of the tree before each of the subtrees
+// below it, so a root-to-leaf lookup touches few cache lines at every scale.
+enum class NodeLayout { InOrder, VanEmdeBoas };
+
+// Hands out the revisions of every tree in the process from one counter, so
+// no two trees, or two trees built one after the other at the same address,
+// ever share a revision.
+inline unsigned long long next_tree_revision() {
+    static std::atomic<unsigned long long> counter{0};
+    return counter.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+// `AVLTreeBase` is a header-only AVL tree with no virtual functions. It has
+// the same `insert`/`remove`/`contains`/`size`/`clear`/`getRootNode` contract
+// as `AVLInterface`, but because every call is resolved at compile time the
+// compiler is free to inline the whole operation into the caller's loop.
+//
+// The base is written in the CRTP style: a concrete tree passes itself as
+// `Derived` and may pick a node type that extends `Node`. Code that wants the
+// fast path should either use a concrete tree type directly or be a template
+// over the tree type. Code that wants runtime polymorphism (like `tests.cpp`
+// and the helpers in `printing.h`) should go through the adapter in `AVL.h`.
+//
+// Every operation walks down the tree iteratively and remembers the links it
+// followed, so rebalancing on the way back up never recurses and stops as
+// soon as a subtree's height is unchanged.
+//
+// Nodes come from a `NodePool`, so they sit close together in memory and can
+// be packed densely again with `compact` after a lot of removals.
+//
+// The tree keeps pointers to its smallest and largest nodes, so `min` and
+// `max` take O(1) time, which makes it usable as a double-ended priority
+// queue through `pop_min` and `pop_max`.
+//
+// `contains` can optionally check a small `LookupCache` before walking the
+// tree. The cache is off until `enable_lookup_cache` is called. Because it is
+// updated by `contains`, a tree with the cache on must not be read from
+// several threads at once.
+template <typename Derived, typename NodeT = Node>
+class AVLTreeBase {
+protected:
+    // An AVL tree holding every `int` is at most ~45 levels tall, so a fixed
+    // array is always big enough to hold a root-to-leaf path.
+    static constexpr int kMaxDepth = 64;
+
+public:
+    using node_type = NodeT;
+
+    // A `Handle` remembers where a value lives in the tree: the node holding
+    // it and the path of links from the root down to that node. `insert(hint,
+    // data)` uses that to start its search at the lowest subtree on the path
+    // that can hold `data` instead of at the root, so inserting values close
+    // to the previous one (like appending mostly-sorted values) takes
+    // amortized O(1) time.
+    //
+    // Any change to the tree that doesn't go through the handle itself makes
+    // it stale. A stale handle, or one from another tree, is still safe to
+    // pass to `insert`, which then starts from the root, but its `node()`
+    // must not be used.
+    class Handle {
+    public:
+        NodeT *node() const {
+            return depth < 0 ? nullptr : static_cast<NodeT *>(*links[depth]);
+        }
+
+    private:
+        friend class AVLTreeBase;
+
+        // Returns the deepest level on the path whose subtree may hold `data`.
+        // Each subtree is bounded by the nearest node above it where the path
+        // went right (from below) and the nearest where it went left (from
+        // above); nodes further up on the same side are looser bounds. So the
+        // walk up can stop once it has passed one node on each side with
+        // `data` between them, or found there is none on a side.
+        int climb(int data) const {
+            int level = depth;
+            bool lower_checked = (right_turns & above(level)) == 0;
+            bool upper_checked = (~right_turns & above(level)) == 0;
+            for (int i = depth - 1; i >= 0 && !(lower_checked && upper_checked); --i) {
+                bool right = (right_turns >> i) & 1;
+                if (right ? lower_checked : upper_checked) {
+                    continue;
+                }
+                int bound = (*links[i])->data;
+                if (right ? bound < data : data < bound) {
+                    (right ? lower_checked : upper_checked) = true;
+                } else {
+                    // `data` belongs in this node's subtree but not below it.
+                    level = i;
+                    lower_checked = (right_turns & above(level)) == 0;
+                    upper_checked = (~right_turns & above(level)) == 0;
+                }
+            }
+            return level;
+        }
+
+        // The bits of `right_turns` for the levels above `level`.
+        static unsigned long long above(int level) {
+            return (1ull << level) - 1;
+        }
+
+        Node **links[kMaxDepth];
+        int depth = -1;
+        // Bit i is set if the path goes right at level i.
+        unsigned long long right_turns = 0;
+        // The tree's revision when the path was found. Revisions are unique
+        // across trees, so this also tells which tree the path belongs to.
+        unsigned long long revision = 0;
+    };
+
+    AVLTreeBase() = default;
+    AVLTreeBase(const AVLTreeBase &) = delete;
+    AVLTreeBase &operator=(const AVLTreeBase &) = delete;
+
+    ~AVLTreeBase() {
+        clear();
+    }
+
+    NodeT *getRootNode() const {
+        return static_cast<NodeT *>(root);
+    }
+
+    bool insert(int data) {
+        Node **links[kMaxDepth];
+        int depth = 0;
+
+        Node **link = &root;
+        while (*link != nullptr) {
+            Node *node = *link;
+            if (data == node->data) {
+                return false;
+            }
+            links[depth++] = link;
+            link = data < node->data ? &node->left : &node->right;
+        }
+
+        *link = pool.allocate(data);
+        ++count;
+        revision = next_tree_revision();
+        note(data, true);
+        extend_ends(*link);
+        retrace(links, depth);
+        return true;
+    }
+
+    // Finds `data`, inserting it if it isn't in the tree yet, and points
+    // `handle` at its node, all in one descent. Returns whether it was
+    // inserted.
+    bool find_or_insert(Handle &handle, int data) {
+        handle.depth = -1;
+        return insert(handle, data);
+    }
+
+    // Inserts `data` starting from the position `hint` refers to, and returns
+    // whether it was new. Either way, `hint` then refers to `data`'s node, so
+    // it can be passed straight to the next call.
+    bool insert(Handle &hint, int data) {
+        int level = 0;
+        if (hint.revision == revision && hint.depth >= 0) {
+            level = hint.climb(data);
+        } else {
+            hint.links[0] = &root;
+            hint.revision = revision;
+        }
+
+        level = descend(hint, level, data);
+        if (*hint.links[level] != nullptr) {
+            hint.depth = level;
+            return false;
+        }
+
+        *hint.links[level] = pool.allocate(data);
+        ++count;
+        hint.revision = revision = next_tree_revision();
+        note(data, true);
+        extend_ends(*hint.links[level]);
+
+        // Everything above the highest rotation keeps its place, so only the
+        // path below it has to be found again.
+        int rotated = retrace(hint.links, level);
+        hint.depth = rotated < level ? descend(hint, rotated, data) : level;
+        return true;
+    }
+
+    bool remove(int data) {
+        Node **links[kMaxDepth];
+        int depth = find_path(links, data);
+        if (*links[depth] == nullptr) {
+            return false;
+        }
+        remove_at(links, depth);
+        return true;
+    }
+
+    bool contains(int data) const {
+        if (!cache.enabled()) {
+            return search(data);
+        }
+        bool present = false;
+        if (!cache.lookup(data, present)) {
+            present = search(data);
+            cache.store(data, present);
+        }
+        return present;
+    }
+
+    void clear() {
+        if (!std::is_trivially_destructible<NodeT>::value) {
+            destroy_subtree(root);
+        }
+        pool.release();
+        root = nullptr;
+        smallest = nullptr;
+        largest = nullptr;
+        count = 0;
+        revision = next_tree_revision();
+        cache.flush();
+    }
+
+    int size() const {
+        return count;
+    }
+
+    // The nodes holding the smallest and largest values, or nullptr if the
+    // tree is empty.
+    NodeT *min() const {
+        return static_cast<NodeT *>(smallest);
+    }
+
+    NodeT *max() const {
+        return static_cast<NodeT *>(largest);
+    }
+
+    // Removes the smallest value from the tree and stores it in `data`, or
+    // returns false if the tree is empty. Takes O(log n) time.
+    bool pop_min(int &data) {
+        if (smallest == nullptr) {
+            return false;
+        }
+        data = smallest->data;
+        return remove(data);
+    }
+
+    // Removes the largest value from the tree and stores it in `data`, or
+    // returns false if the tree is empty. Takes O(log n) time.
+    bool pop_max(int &data) {
+        if (largest == nullptr) {
+            return false;
+        }
+        data = largest->data;
+        return remove(data);
+    }
+
+    // Inserts every value in [first, last), which doesn't need to be sorted
+    // or free of duplicates, and returns how many of them were new. The batch
+    // is sorted in parallel and then merged into the tree by splitting it
+    // around each node and joining the results back together, with the two
+    // halves of big batches handled on different threads. This is much faster
+    // than calling `insert` once per value for big batches. A batch split
+    // across threads first drops the values already in the tree, looking them
+    // up in parallel, and then gets one new slab with exactly one slot for
+    // each value that is left.
+    template <typename Iterator>
+    int insert_range(Iterator first, Iterator last) {
+        int forks = bulk_forks();
+        std::vector<int> batch = sorted_batch(first, last, forks);
+        int added = 0;
+        BulkNodes bulk;
+        if (forks > 0 && batch.size() >= kParallelCutoff) {
+            drop_present(batch, forks);
+            bulk.block = pool.reserve_block(batch.size());
+        }
+        bulk.batch = batch.data();
+        root = insert_sorted(root, batch.data(), batch.data() + batch.size(), forks, bulk, added);
+        pool.finish_block(bulk.block);
+        count += added;
+        revision = next_tree_revision();
+        find_ends();
+        for (int value : batch) {
+            note(value, true);
+        }
+        return added;
+    }
+
+    // Removes every value in [first, last), which doesn't need to be sorted
+    // or free of duplicates, and returns how many of them were in the tree.
+    // Works the same way as `insert_range`.
+    template <typename Iterator>
+    int erase_range(Iterator first, Iterator last) {
+        int forks = bulk_forks();
+        std::vector<int> batch = sorted_batch(first, last, forks);
+        int removed = 0;
+        BulkNodes bulk;
+        bulk.batch = batch.data();
+        if (forks > 0 && batch.size() >= kParallelCutoff) {
+            bulk.removed.assign(batch.size(), nullptr);
+        }
+        root = erase_sorted(root, batch.data(), batch.data() + batch.size(), forks, bulk, removed);
+        for (Node *node : bulk.removed) {
+            if (node != nullptr) {
+                destroy(node);
+            }
+        }
+        count -= removed;
+        revision = next_tree_revision();
+        find_ends();
+        for (int value : batch) {
+            note(value, false);
+        }
+        return removed;
+    }
+
+    // Makes `insert_range` and `erase_range` split big batches `depth` levels
+    // deep, over up to 2^`depth` threads, however many hardware threads there
+    // are (at most `kMaxForkDepth` levels). A negative `depth` goes back to
+    // matching the hardware, which is the default.
+    void set_fork_depth(int depth) {
+        fork_levels = std::min(depth, kMaxForkDepth);
+    }
+
+    // Puts a lookup cache with room for `slots` values (rounded up to a power
+    // of two) in front of `contains`, or turns it off if `slots` is 0. A few
+    // thousand slots is plenty when a small set of values gets most lookups;
+    // check `lookup_cache_stats()` to see whether it is paying off.
+    void enable_lookup_cache(size_t slots) {
+        cache.resize(slots);
+    }
+
+    LookupCacheStats lookup_cache_stats() const {
+        return cache.statistics();
+    }
+
+    // Reports how much memory the tree's nodes take up, including the space
+    // that removed nodes left behind. Memory a node type allocates on its own
+    // is only counted by derived trees that fill in `heap_bytes`.
+    MemoryUsage memory_usage() const {
+        MemoryUsage usage = pool.usage();
+        usage.overhead_bytes += sizeof(Derived) + cache.memory_bytes();
+        return usage;
+    }
+
+    // Moves every node into one new, densely packed slab laid out in the
+    // given order, and gives the old slabs back to the system. The shape of
+    // the tree doesn't change, but every node moves, so pointers to nodes
+    // taken before calling this are no longer valid. Takes O(n) time
+    // (O(n log log n) for `VanEmdeBoas`) and O(n) extra memory while it runs.
+    void compact(NodeLayout layout = NodeLayout::InOrder) {
+        std::vector<Node *> order;
+        order.reserve(static_cast<size_t>(count));
+        if (layout == NodeLayout::InOrder) {
+            collect_in_order(root, order);
+        } else {
+            collect_van_emde_boas(root, height(root), order);
+        }
+
+        NodePool<NodeT> retired;
+        pool.retire(retired);
+        pool.reserve_dense(order.size());
+
+        // Each old node's `left` is free once it has been copied, so it is
+        // used to remember where the copy went.
+        for (Node *old : order) {
+            Node *moved = pool.allocate(std::move(*static_cast<NodeT *>(old)));
+            old->left = moved;
+        }
+        for (Node *old : order) {
+            Node *moved = old->left;
+            moved->left = moved->left == nullptr ? nullptr : moved->left->left;
+            moved->right = moved->right == nullptr ? nullptr : moved->right->left;
+        }
+        if (root != nullptr) {
+            root = root->left;
+        }
+        revision = next_tree_revision();
+        find_ends();
+
+        if (!std::is_trivially_destructible<NodeT>::value) {
+            for (Node *old : order) {
+                static_cast<NodeT *>(old)->~NodeT();
+            }
+        }
+    }
+
+protected:
+    bool search(int data) const {
+        const Node *node = root;
+        while (node != nullptr) {
+            if (data == node->data) {
+                return true;
+            }
+            node = data < node->data ? node->left : node->right;
+        }
+        return false;
+    }
+
+    // Tells the lookup cache that `data` was just inserted or removed.
+    void note(int data, bool present) {
+        if (cache.enabled()) {
+            cache.note(data, present);
+        }
+    }
+
+    static Node *leftmost(Node *node) {
+        while (node != nullptr && node->left != nullptr) {
+            node = node->left;
+        }
+        return node;
+    }
+
+    static Node *rightmost(Node *node) {
+        while (node != nullptr && node->right != nullptr) {
+            node = node->right;
+        }
+        return node;
+    }
+
+    // Updates `smallest` and `largest` for a node that was just inserted.
+    void extend_ends(Node *node) {
+        if (smallest == nullptr || node->data < smallest->data) {
+            smallest = node;
+        }
+        if (largest == nullptr || node->data > largest->data) {
+            largest = node;
+        }
+    }
+
+    // Finds `smallest` and `largest` again after the tree was restructured.
+    void find_ends() {
+        smallest = leftmost(root);
+        largest = rightmost(root);
+    }
+
+    static int height(const Node *node) {
+        return node == nullptr ? 0 : node->height;
+    }
+
+    static int balance(const Node *node) {
+        return height(node->left) - height(node->right);
+    }
+
+    // Recomputes everything a node caches about its subtree. Derived trees
+    // that cache more than the height can hide this with their own `pull`.
+    static void pull(Node *node) {
+        node->height = std::max(height(node->left), height(node->right)) + 1;
+    }
+
+    static void rotate_left(Node **link) {
+        Node *node = *link;
+        Node *right = node->right;
+        node->right = right->left;
+        right->left = node;
+        Derived::pull(node);
+        Derived::pull(right);
+        *link = right;
+    }
+
+    static void rotate_right(Node **link) {
+        Node *node = *link;
+        Node *left = node->left;
+        node->left = left->right;
+        left->right = node;
+        Derived::pull(node);
+        Derived::pull(left);
+        *link = left;
+    }
+
+    // Restores the AVL property at `*link`, assuming both of its subtrees are
+    // already balanced. A child with a balance of 0 gets a single rotation,
+    // which is the convention the key files expect after a removal.
+    static void rebalance(Node **link) {
+        Node *node = *link;
+        Derived::pull(node);
+        int node_balance = balance(node);
+        if (node_balance > 1) {
+            if (balance(node->left) < 0) {
+                rotate_left(&node->left);
+            }
+            rotate_right(link);
+        } else if (node_balance < -1) {
+            if (balance(node->right) > 0) {
+                rotate_right(&node->right);
+            }
+            rotate_left(link);
+        }
+    }
+
+    // Rebalances the nodes behind `links`, deepest first, and stops at the
+    // first subtree whose height didn't change. Returns the highest level
+    // that was rotated, or `depth` if there were no rotations.
+    static int retrace(Node **links[], int depth) {
+        int rotated = depth;
+        for (int i = depth - 1; i >= 0; --i) {
+            Node *node = *links[i];
+            int before = node->height;
+            rebalance(links[i]);
+            if (*links[i] != node) {
+                rotated = i;
+            }
+            if ((*links[i])->height == before && Derived::kStopRetraceEarly) {
+                break;
+            }
+        }
+        return rotated;
+    }
+
+    // Extends the path in `handle` from `level` down towards `data`, and
+    // returns the level of the link that holds `data` or would hold it.
+    static int descend(Handle &handle, int level, int data) {
+        unsigned long long right_turns = handle.right_turns;
+        Node *node = *handle.links[level];
+        while (node != nullptr && node->data != data) {
+            bool go_left = data < node->data;
+            Node **link = go_left ? &node->left : &node->right;
+            right_turns = (right_turns & ~(1ull << level)) | (static_cast<unsigned long long>(!go_left) << level);
+            handle.links[++level] = link;
+            node = *link;
+        }
+        handle.right_turns = right_turns;
+        return level;
+    }
+
+    // Joins `left`, `middle` and `right` into one AVL tree, where every value
+    // in `left` is less than `middle->data` and every value in `right` is
+    // greater. Takes O(|height(left) - height(right)|) time.
+    static Node *join(Node *left, Node *middle, Node *right) {
+        if (height(left) > height(right) + 1) {
+            left->right = join(left->right, middle, right);
+            rebalance(&left);
+            return left;
+        }
+        if (height(right) > height(left) + 1) {
+            right->left = join(left, middle, right->left);
+            rebalance(&right);
+            return right;
+        }
+        middle->left = left;
+        middle->right = right;
+        Derived::pull(middle);
+        return middle;
+    }
+
+    // Unlinks the largest node under `node`, stores it in `max`, and returns
+    // what is left of the subtree.
+    static Node *detach_max(Node *node, Node *&max) {
+        if (node->right == nullptr) {
+            max = node;
+            return node->left;
+        }
+        node->right = detach_max(node->right, max);
+        rebalance(&node);
+        return node;
+    }
+
+    // Joins two trees where every value in `left` is less than every value in
+    // `right`.
+    static Node *join(Node *left, Node *right) {
+        if (left == nullptr) {
+            return right;
+        }
+        Node *max = nullptr;
+        left = detach_max(left, max);
+        return join(left, max, right);
+    }
+
+    template <typename Iterator>
+    static std::vector<int> sorted_batch(Iterator first, Iterator last, int forks) {
+        std::vector<int> batch(first, last);
+        parallel_sort(batch, forks);
+        batch.erase(std::unique(batch.begin(), batch.end()), batch.end());
+        return batch;
+    }
+
+    int bulk_forks() const {
+        return fork_levels < 0 ? fork_depth() : fork_levels;
+    }
+
+    // Removes the values that are already in the tree from the sorted `batch`,
+    // keeping the rest in order. Each of up to 2^`forks` threads filters its
+    // own chunk in place, and the chunks are then moved together.
+    void drop_present(std::vector<int> &batch, int forks) const {
+        size_t chunks = std::max<size_t>(1, std::min(size_t(1) << forks, batch.size() / kParallelCutoff));
+        std::vector<size_t> bounds(chunks + 1);
+        std::vector<size_t> ends(chunks);
+        for (size_t i = 0; i <= chunks; ++i) {
+            bounds[i] = batch.size() * i / chunks;
+        }
+
+        std::vector<std::function<void()>> tasks;
+        for (size_t i = 0; i < chunks; ++i) {
+            tasks.push_back([this, &batch, &bounds, &ends, i] {
+                size_t end = bounds[i];
+                for (size_t j = bounds[i]; j < bounds[i + 1]; ++j) {
+                    if (!search(batch[j])) {
+                        batch[end++] = batch[j];
+                    }
+                }
+                ends[i] = end;
+            });
+        }
+        run_all(tasks);
+
+        size_t kept = ends[0];
+        for (size_t i = 1; i < chunks; ++i) {
+            kept = static_cast<size_t>(std::move(batch.begin() + bounds[i], batch.begin() + ends[i], batch.begin() + kept) - batch.begin());
+        }
+        batch.resize(kept);
+    }
+
+    // Where the bulk operations get and put nodes. A batch that may be split
+    // across threads gives every value in it its own slot in `block` (when
+    // inserting) or `removed` (when erasing), found by the value's position
+    // in the batch. No two threads ever touch the same slot, so nothing needs
+    // a lock, and removed nodes are only freed once every thread is done.
+    // A batch that stays on one thread leaves both empty and uses the pool.
+    struct BulkNodes {
+        const int *batch = nullptr;
+        typename NodePool<NodeT>::Block block;
+        std::vector<Node *> removed;
+    };
+
+    Node *create(const int *value, BulkNodes &bulk) {
+        if (bulk.block.empty()) {
+            return pool.allocate(*value);
+        }
+        return bulk.block.construct(static_cast<size_t>(value - bulk.batch), *value);
+    }
+
+    void destroy(Node *node, const int *value, BulkNodes &bulk) {
+        if (bulk.removed.empty()) {
+            destroy(node);
+        } else {
+            bulk.removed[static_cast<size_t>(value - bulk.batch)] = node;
+        }
+    }
+
+    // Builds a perfectly balanced tree out of the sorted values in [first, last).
+    Node *build(const int *first, const int *last, int forks, BulkNodes &bulk) {
+        if (first == last) {
+            return nullptr;
+        }
+        const int *middle = first + (last - first) / 2;
+        Node *node = create(middle, bulk);
+        fork_join(
+            forks > 0 && static_cast<size_t>(last - first) >= kParallelCutoff,
+            [&] { node->left = build(first, middle, forks - 1, bulk); },
+            [&] { node->right = build(middle + 1, last, forks - 1, bulk); });
+        Derived::pull(node);
+        return node;
+    }
+
+    // Merges the sorted, distinct values in [first, last) into the subtree
+    // rooted at `node` and returns the new root. `forks` is how many more
+    // levels of the recursion may run their halves on separate threads.
+    Node *insert_sorted(Node *node, const int *first, const int *last, int forks, BulkNodes &bulk, int &added) {
+        if (first == last) {
+            return node;
+        }
+        if (node == nullptr) {
+            added += static_cast<int>(last - first);
+            return build(first, last, forks, bulk);
+        }
+
+        const int *split = std::lower_bound(first, last, node->data);
+        const int *right_first = split != last && *split == node->data ? split + 1 : split;
+
+        Node *left = node->left;
+        Node *right = node->right;
+        int left_added = 0;
+        int right_added = 0;
+        fork_join(
+            forks > 0 && static_cast<size_t>(last - first) >= kParallelCutoff,
+            [&] { left = insert_sorted(left, first, split, forks - 1, bulk, left_added); },
+            [&] { right = insert_sorted(right, right_first, last, forks - 1, bulk, right_added); });
+        added += left_added + right_added;
+
+        return join(left, node, right);
+    }
+
+    // Removes the sorted, distinct values in [first, last) from the subtree
+    // rooted at `node` and returns the new root.
+    Node *erase_sorted(Node *node, const int *first, const int *last, int forks, BulkNodes &bulk, int &removed) {
+        if (node == nullptr || first == last) {
+            return node;
+        }
+
+        const int *split = std::lower_bound(first, last, node->data);
+        bool found = split != last && *split == node->data;
+        const int *right_first = found ? split + 1 : split;
+
+        Node *left = node->left;
+        Node *right = node->right;
+        int left_removed = 0;
+        int right_removed = 0;
+        fork_join(
+            forks > 0 && static_cast<size_t>(last - first) >= kParallelCutoff,
+            [&] { left = erase_sorted(left, first, split, forks - 1, bulk, left_removed); },
+            [&] { right = erase_sorted(right, right_first, last, forks - 1, bulk, right_removed); });
+        removed += left_removed + right_removed;
+
+        if (!found) {
+            return join(left, node, right);
+        }
+        ++removed;
+        destroy(node, split, bulk);
+        return join(left, right);
+    }
+
+    static void collect_in_order(Node *node, std::vector<Node *> &order) {
+        while (node != nullptr) {
+            collect_in_order(node->left, order);
+            order.push_back(node);
+            node = node->right;
+        }
+    }
+
+    // Appends the top `levels` levels of the subtree rooted at `node` in van
+    // Emde Boas order: the top half of those levels first, then each subtree
+    // hanging below the top half, left to right.
+    static void collect_van_emde_boas(Node *node, int levels, std::vector<Node *> &order) {
+        if (node == nullptr || levels <= 0) {
+            return;
+        }
+        if (levels == 1) {
+            order.push_back(node);
+            return;
+        }
+        int top_levels = levels / 2;
+        collect_van_emde_boas(node, top_levels, order);
+
+        std::vector<Node *> bottoms;
+        collect_at_depth(node, top_levels, bottoms);
+        for (Node *bottom : bottoms) {
+            collect_van_emde_boas(bottom, levels - top_levels, order);
+        }
+    }
+
+    static void collect_at_depth(Node *node, int depth, std::vector<Node *> &nodes) {
+        if (node == nullptr) {
+            return;
+        }
+        if (depth == 0) {
+            nodes.push_back(node);
+            return;
+        }
+        collect_at_depth(node->left, depth - 1, nodes);
+        collect_at_depth(node->right, depth - 1, nodes);
+    }
+
+    void destroy(Node *node) {
+        pool.deallocate(static_cast<NodeT *>(node));
+    }
+
+    void destroy_subtree(Node *node) {
+        while (node != nullptr) {
+            destroy_subtree(node->left);
+            Node *right = node->right;
+            destroy(node);
+            node = right;
+        }
+    }
+
+    // Calls `visit(node)` for every node on the path `handle` remembers, from
+    // the root down to its node.
+    template <typename Visit>
+    static void visit_path(const Handle &handle, const Visit &visit) {
+        for (int level = 0; level <= handle.depth; ++level) {
+            visit(static_cast<NodeT *>(*handle.links[level]));
+        }
+    }
+
+    // Fills `links` with the path of links from `&root` down to the one that
+    // holds `data` or would hold it, and returns that link's level.
+    int find_path(Node **links[], int data) {
+        int depth = 0;
+        links[0] = &root;
+        while (*links[depth] != nullptr && (*links[depth])->data != data) {
+            Node *node = *links[depth];
+            links[depth + 1] = data < node->data ? &node->left : &node->right;
+            ++depth;
+        }
+        return depth;
+    }
+
+    // Removes the node at `*links[depth]`, where `links` is a path found by
+    // `find_path`, and rebalances the nodes above it. `links` is reused for
+    // the retrace, so it needs room for `kMaxDepth` links.
+    void remove_at(Node **links[], int depth) {
+        Node **link = links[depth];
+        Node *target = *link;
+        int data = target->data;
+        // The smallest node has no left child, so the next smallest is the
+        // smallest node under its right child or else its parent (and the
+        // same the other way around for the largest node).
+        Node *parent = depth > 0 ? *links[depth - 1] : nullptr;
+        if (target == smallest) {
+            smallest = target->right != nullptr ? leftmost(target->right) : parent;
+        }
+        if (target == largest) {
+            largest = target->left != nullptr ? rightmost(target->left) : parent;
+        }
+
+        if (target->left != nullptr && target->right != nullptr) {
+            // Same convention as the BST lab: the in-order predecessor takes
+            // the removed node's place. The predecessor node itself is moved
+            // (rather than copying its data) so no other node changes address.
+            int target_depth = depth++;
+
+            Node **pred_link = &target->left;
+            while ((*pred_link)->right != nullptr) {
+                links[depth++] = pred_link;
+                pred_link = &(*pred_link)->right;
+            }
+
+            Node *pred = *pred_link;
+            *pred_link = pred->left;
+            pred->left = target->left;
+            pred->right = target->right;
+            pred->height = target->height;
+            *link = pred;
+
+            if (depth > target_depth + 1) {
+                links[target_depth + 1] = &pred->left;
+            }
+        } else {
+            *link = target->left != nullptr ? target->left : target->right;
+        }
+
+        destroy(target);
+        --count;
+        revision = next_tree_revision();
+        note(data, false);
+        retrace(links, depth);
+    }
+
+    // Derived trees whose `pull` caches more than the height must see every
+    // ancestor of a change, so they set this to false.
+    static constexpr bool kStopRetraceEarly = true;
+
+    Node *root = nullptr;
+    Node *smallest = nullptr;
+    Node *largest = nullptr;
+    int count = 0;
+    // Replaced by every change to the tree, so handles can tell they're stale.
+    unsigned long long revision = next_tree_revision();
+    NodePool<NodeT> pool;
+    // Set by `set_fork_depth`, or negative to use `fork_depth()`.
+    int fork_levels = -1;
+    mutable LookupCache cache;
+};
+
+// The plain AVL tree of `int`s.
+class AVLTree final : public AVLTreeBase<AVLTree> {};
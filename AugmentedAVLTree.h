@@ -0,0 +1,171 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+
+#include "AVLTree.h"
+#include "Node.h"
+
+// A monoid tells `AugmentedAVLTree` what to keep for every subtree. It needs:
+//
+//   value_type                           the type of the aggregate
+//   static value_type identity()         the aggregate of an empty subtree
+//   static value_type lift(int data)     the aggregate of a single value
+//   static value_type combine(a, b)      the aggregate of a followed by b
+//
+// `combine` must be associative, and `identity()` must leave anything it is
+// combined with unchanged. It doesn't have to be commutative: aggregates are
+// always combined in increasing order of the values.
+
+struct SumMonoid {
+    using value_type = long long;
+
+    static value_type identity() {
+        return 0;
+    }
+
+    static value_type lift(int data) {
+        return data;
+    }
+
+    static value_type combine(value_type a, value_type b) {
+        return a + b;
+    }
+};
+
+struct CountMonoid {
+    using value_type = int;
+
+    static value_type identity() {
+        return 0;
+    }
+
+    static value_type lift(int) {
+        return 1;
+    }
+
+    static value_type combine(value_type a, value_type b) {
+        return a + b;
+    }
+};
+
+struct MinMonoid {
+    using value_type = int;
+
+    static value_type identity() {
+        return INT_MAX;
+    }
+
+    static value_type lift(int data) {
+        return data;
+    }
+
+    static value_type combine(value_type a, value_type b) {
+        return std::min(a, b);
+    }
+};
+
+struct MaxMonoid {
+    using value_type = int;
+
+    static value_type identity() {
+        return INT_MIN;
+    }
+
+    static value_type lift(int data) {
+        return data;
+    }
+
+    static value_type combine(value_type a, value_type b) {
+        return std::max(a, b);
+    }
+};
+
+template <typename Monoid>
+struct AugmentedNode : Node {
+    AugmentedNode(int data) : Node(data), aggregate(Monoid::lift(data)) {}
+
+    // The aggregate of every value in this node's subtree.
+    typename Monoid::value_type aggregate;
+};
+
+// `AugmentedAVLTree` is an AVL tree where every node also keeps the aggregate
+// of its subtree under `Monoid`. The aggregates are recomputed only for the
+// nodes whose subtrees change: the ones rotated and the ones on the path of
+// an insert or remove. That lets `reduce` combine every value in a range in
+// O(log n) time instead of visiting each one.
+template <typename Monoid>
+class AugmentedAVLTree final : public AVLTreeBase<AugmentedAVLTree<Monoid>, AugmentedNode<Monoid>> {
+    using Base = AVLTreeBase<AugmentedAVLTree<Monoid>, AugmentedNode<Monoid>>;
+    using NodeT = AugmentedNode<Monoid>;
+    friend Base;
+
+public:
+    using monoid_type = Monoid;
+    using value_type = typename Monoid::value_type;
+
+    // Combines the values from `lo` to `hi` (both inclusive) in increasing
+    // order. Returns `Monoid::identity()` if there are none.
+    value_type reduce(int lo, int hi) const {
+        if (lo > hi) {
+            return Monoid::identity();
+        }
+
+        // Find the highest node in the range. Everything in the range is in
+        // its subtree.
+        const Node *split = this->root;
+        while (split != nullptr && (split->data < lo || split->data > hi)) {
+            split = split->data < lo ? split->right : split->left;
+        }
+        if (split == nullptr) {
+            return Monoid::identity();
+        }
+
+        // Walking down from `split` towards `lo`, every node at least `lo`
+        // is in the range along with its whole right subtree. Those pieces
+        // are found from largest to smallest.
+        value_type below = Monoid::identity();
+        for (const Node *node = split->left; node != nullptr;) {
+            if (node->data >= lo) {
+                below = Monoid::combine(Monoid::combine(Monoid::lift(node->data), aggregate(node->right)), below);
+                node = node->left;
+            } else {
+                node = node->right;
+            }
+        }
+
+        // The same towards `hi`, where the pieces are found from smallest to
+        // largest.
+        value_type above = Monoid::identity();
+        for (const Node *node = split->right; node != nullptr;) {
+            if (node->data <= hi) {
+                above = Monoid::combine(above, Monoid::combine(aggregate(node->left), Monoid::lift(node->data)));
+                node = node->right;
+            } else {
+                node = node->left;
+            }
+        }
+
+        return Monoid::combine(Monoid::combine(below, Monoid::lift(split->data)), above);
+    }
+
+    // The aggregate of every value in the tree.
+    value_type reduce() const {
+        return aggregate(this->root);
+    }
+
+    static value_type aggregate(const Node *node) {
+        return node == nullptr ? Monoid::identity() : static_cast<const NodeT *>(node)->aggregate;
+    }
+
+private:
+    // Every ancestor of a change has a new aggregate, even when its height
+    // stays the same.
+    static constexpr bool kStopRetraceEarly = false;
+
+    static void pull(Node *node) {
+        Base::pull(node);
+        static_cast<NodeT *>(node)->aggregate = Monoid::combine(
+            Monoid::combine(aggregate(node->left), Monoid::lift(node->data)), aggregate(node->right));
+    }
+};
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <functional>
+#include <ostream>
+#include <vector>
+
+#include "AVLTree.h"
+#include "Node.h"
+
+// A half-open range of `int`s: every x with lo <= x < hi.
+struct Interval {
+    int lo;
+    int hi;
+};
+
+// Orders intervals by `lo`, then by `hi`.
+inline bool operator<(const Interval &a, const Interval &b) {
+    return a.lo != b.lo ? a.lo < b.lo : a.hi < b.hi;
+}
+
+inline bool operator==(const Interval &a, const Interval &b) {
+    return a.lo == b.lo && a.hi == b.hi;
+}
+
+inline std::ostream &operator<<(std::ostream &out, const Interval &interval) {
+    return out << '[' << interval.lo << ", " << interval.hi << ')';
+}
+
+// A node holds every interval that starts at `data`.
+struct IntervalNode : Node {
+    IntervalNode(int lo) : Node(lo), max_hi(INT_MIN) {}
+
+    // The `hi` of each interval starting at `data`, largest first.
+    std::vector<int> his;
+    // The largest `hi` of any interval in this node's subtree.
+    int max_hi;
+};
+
+// `IntervalTree` stores intervals in an AVL tree ordered by `lo`. Every node
+// also keeps the largest `hi` in its subtree, which the usual AVL rotations
+// keep up to date through the `pull` hook. A query can then skip any subtree
+// whose largest `hi` shows none of its intervals reach far enough, so it only
+// visits subtrees that hold at least one result: finding the k intervals
+// that contain a point or overlap a range takes O(log n) time when k is 0
+// and grows with k rather than with n, at worst O((k + 1) log n).
+//
+// Intervals with the same `lo` share a node, so `getRootNode()` and the
+// helpers in `printing.h` show one node per distinct `lo`.
+class IntervalTree final : protected AVLTreeBase<IntervalTree, IntervalNode> {
+    using Base = AVLTreeBase<IntervalTree, IntervalNode>;
+    friend Base;
+
+public:
+    using Base::compact;
+    using Base::getRootNode;
+
+    // Inserts [lo, hi) and returns whether it was new. Empty intervals (where
+    // `hi <= lo`) are never stored.
+    bool insert(int lo, int hi) {
+        if (hi <= lo) {
+            return false;
+        }
+        Handle handle;
+        find_or_insert(handle, lo);
+        IntervalNode *node = handle.node();
+        auto position = std::lower_bound(node->his.begin(), node->his.end(), hi, std::greater<int>());
+        if (position != node->his.end() && *position == hi) {
+            return false;
+        }
+        node->his.insert(position, hi);
+        ++intervals;
+
+        // `hi` can only raise the largest `hi` of the subtrees on the path,
+        // which the handle already holds.
+        visit_path(handle, [hi](IntervalNode *path_node) { path_node->max_hi = std::max(path_node->max_hi, hi); });
+        return true;
+    }
+
+    // Removes [lo, hi) and returns whether it was in the tree.
+    bool remove(int lo, int hi) {
+        Node **links[kMaxDepth];
+        int depth = Base::find_path(links, lo);
+        if (*links[depth] == nullptr) {
+            return false;
+        }
+
+        IntervalNode *node = static_cast<IntervalNode *>(*links[depth]);
+        auto position = std::lower_bound(node->his.begin(), node->his.end(), hi, std::greater<int>());
+        if (position == node->his.end() || *position != hi) {
+            return false;
+        }
+        node->his.erase(position);
+        --intervals;
+
+        // A node with no intervals left is removed. Otherwise the largest
+        // `hi` of each subtree on the path may have gone down.
+        if (node->his.empty()) {
+            Base::remove_at(links, depth);
+            return true;
+        }
+        for (int i = depth; i >= 0; --i) {
+            pull(*links[i]);
+        }
+        return true;
+    }
+
+    bool contains(int lo, int hi) const {
+        const Node *node = root;
+        while (node != nullptr && node->data != lo) {
+            node = lo < node->data ? node->left : node->right;
+        }
+        if (node == nullptr) {
+            return false;
+        }
+        const std::vector<int> &his = static_cast<const IntervalNode *>(node)->his;
+        return std::binary_search(his.begin(), his.end(), hi, std::greater<int>());
+    }
+
+    void clear() {
+        Base::clear();
+        intervals = 0;
+    }
+
+    // The number of intervals in the tree.
+    int size() const {
+        return intervals;
+    }
+
+    // Calls `report(interval)` for every interval that contains `point`.
+    template <typename Report>
+    void stab(int point, Report &&report) const {
+        stab(root, point, report);
+    }
+
+    // Calls `report(interval)` for every interval that shares at least one
+    // value with [lo, hi).
+    template <typename Report>
+    void overlap(int lo, int hi, Report &&report) const {
+        if (lo < hi) {
+            overlap(root, lo, hi, report);
+        }
+    }
+
+    // Calls `report(interval)` for every interval, in order of `lo`.
+    template <typename Report>
+    void for_each(Report &&report) const {
+        for_each(root, report);
+    }
+
+    // Like `AVLTreeBase::memory_usage`, with each node's list of `hi`s in
+    // `heap_bytes`. Takes O(n) time.
+    MemoryUsage memory_usage() const {
+        MemoryUsage usage = Base::memory_usage();
+        for_each_node(root, [&usage](const IntervalNode *node) {
+            usage.heap_bytes += node->his.capacity() * sizeof(int);
+        });
+        return usage;
+    }
+
+    static int max_hi(const Node *node) {
+        return node == nullptr ? INT_MIN : static_cast<const IntervalNode *>(node)->max_hi;
+    }
+
+private:
+    // Every ancestor of a change may have a new largest `hi`, even when its
+    // height stays the same.
+    static constexpr bool kStopRetraceEarly = false;
+
+    static void pull(Node *node) {
+        Base::pull(node);
+        IntervalNode *interval_node = static_cast<IntervalNode *>(node);
+        int own = interval_node->his.empty() ? INT_MIN : interval_node->his.front();
+        interval_node->max_hi = std::max({own, max_hi(node->left), max_hi(node->right)});
+    }
+
+    // Reports the intervals of `node` whose `hi` is above `above`. They are
+    // stored largest first, so this stops at the first one that isn't.
+    template <typename Report>
+    static void report_his(const Node *node, int above, Report &report) {
+        for (int hi : static_cast<const IntervalNode *>(node)->his) {
+            if (hi <= above) {
+                break;
+            }
+            report(Interval{node->data, hi});
+        }
+    }
+
+    template <typename Report>
+    static void stab(const Node *node, int point, Report &report) {
+        while (node != nullptr && max_hi(node) > point) {
+            stab(node->left, point, report);
+            if (node->data > point) {
+                return;
+            }
+            report_his(node, point, report);
+            node = node->right;
+        }
+    }
+
+    template <typename Report>
+    static void overlap(const Node *node, int lo, int hi, Report &report) {
+        while (node != nullptr && max_hi(node) > lo) {
+            overlap(node->left, lo, hi, report);
+            if (node->data >= hi) {
+                return;
+            }
+            report_his(node, lo, report);
+            node = node->right;
+        }
+    }
+
+    template <typename Report>
+    static void for_each(const Node *node, Report &report) {
+        for_each_node(node, [&report](const IntervalNode *interval_node) {
+            const std::vector<int> &his = interval_node->his;
+            for (auto hi = his.rbegin(); hi != his.rend(); ++hi) {
+                report(Interval{interval_node->data, *hi});
+            }
+        });
+    }
+
+    template <typename Visit>
+    static void for_each_node(const Node *node, const Visit &visit) {
+        while (node != nullptr) {
+            for_each_node(node->left, visit);
+            visit(static_cast<const IntervalNode *>(node));
+            node = node->right;
+        }
+    }
+
+    int intervals = 0;
+};
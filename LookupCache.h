@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// How often lookups were answered by a tree's lookup cache.
+struct LookupCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+    double hit_rate() const {
+        uint64_t lookups = hits + misses;
+        return lookups == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(lookups);
+    }
+};
+
+// `LookupCache` is a small direct-mapped table that remembers the answers to
+// recent `contains` calls, both hits and misses. Each value can only live in
+// one slot, picked by hashing it, so a lookup is one probe into a table small
+// enough to stay in the CPU cache. When a query stream keeps asking about the
+// same few values, most lookups never touch the tree.
+//
+// The tree keeps the table exact: `note` is called with every value whose
+// membership changes, and updates the slot if it holds that value.
+class LookupCache {
+public:
+    // Resizes the table to hold `slots` values (rounded up to a power of two,
+    // and at least 2), forgetting everything in it and resetting the stats. 0
+    // turns the cache off.
+    void resize(size_t slots) {
+        size_t capacity = 0;
+        shift = 64;
+        if (slots > 0) {
+            capacity = 2;
+            shift = 63;
+            while (capacity < slots) {
+                capacity *= 2;
+                --shift;
+            }
+        }
+        entries.assign(capacity, Entry());
+        stats = LookupCacheStats();
+    }
+
+    bool enabled() const {
+        return !entries.empty();
+    }
+
+    size_t capacity() const {
+        return entries.size();
+    }
+
+    size_t memory_bytes() const {
+        return entries.capacity() * sizeof(Entry);
+    }
+
+    // Returns true and sets `present` if the answer for `value` is cached.
+    bool lookup(int value, bool &present) {
+        const Entry &entry = slot(value);
+        if (entry.used && entry.value == value) {
+            ++stats.hits;
+            present = entry.present;
+            return true;
+        }
+        ++stats.misses;
+        return false;
+    }
+
+    void store(int value, bool present) {
+        Entry &entry = slot(value);
+        entry.value = value;
+        entry.present = present;
+        entry.used = true;
+    }
+
+    // Records that `value` is now in the tree (or not), if it is cached.
+    void note(int value, bool present) {
+        Entry &entry = slot(value);
+        if (entry.used && entry.value == value) {
+            entry.present = present;
+        }
+    }
+
+    // Forgets every cached answer but keeps the stats.
+    void flush() {
+        entries.assign(entries.size(), Entry());
+    }
+
+    const LookupCacheStats &statistics() const {
+        return stats;
+    }
+
+private:
+    struct Entry {
+        int value = 0;
+        bool present = false;
+        bool used = false;
+    };
+
+    // Fibonacci hashing: the top bits of the product pick the slot, so
+    // nearby values spread out over the whole table.
+    Entry &slot(int value) {
+        uint64_t hash = static_cast<uint64_t>(static_cast<uint32_t>(value)) * 0x9E3779B97F4A7C15ull;
+        return entries[static_cast<size_t>(hash >> shift)];
+    }
+
+    std::vector<Entry> entries;
+    int shift = 64;
+    LookupCacheStats stats;
+};
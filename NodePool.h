@@ -0,0 +1,219 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// How much memory a tree is using. The slabs the nodes are spread over are
+// split three ways:
+//
+//   slab_bytes = node_bytes + free_bytes + unused_bytes
+//
+// `free_bytes` is the space left behind by removed nodes. It is scattered
+// between live nodes, so it is what `compact` gets rid of. `overhead_bytes`
+// and `heap_bytes` come on top of `slab_bytes`: the first is the tree and the
+// pool's own bookkeeping, the second is memory the nodes own outside their
+// slots.
+struct MemoryUsage {
+    size_t nodes = 0;         // live nodes
+    size_t free_slots = 0;    // slots freed by removals and not reused yet
+    size_t unused_slots = 0;  // slots at the end of the newest slab never used
+    size_t slabs = 0;         // blocks of slots allocated from the system
+
+    size_t node_bytes = 0;
+    size_t free_bytes = 0;
+    size_t unused_bytes = 0;
+    size_t slab_bytes = 0;
+    size_t overhead_bytes = 0;  // the tree itself and the pool's bookkeeping
+    size_t heap_bytes = 0;      // allocated by the nodes themselves
+
+    // The share of the slab memory that is stranded between live nodes. 0
+    // means the nodes are packed densely.
+    double fragmentation() const {
+        return slab_bytes == 0 ? 0.0 : static_cast<double>(free_bytes) / static_cast<double>(slab_bytes);
+    }
+};
+
+// `NodePool` hands out nodes from big slabs instead of allocating each one
+// with `new`. Removed nodes go on a free list and are reused first. Slabs
+// grow geometrically, so the memory is only returned to the system by
+// `release` (which the tree calls from `clear` and `compact`).
+//
+// The pool isn't thread-safe. Code that needs nodes on several threads at
+// once sets aside a `Block` of slots first and fills it in without locking.
+template <typename NodeT>
+class NodePool {
+    union Slot;
+
+public:
+    // A run of consecutive slots set aside by `reserve_block`. Each slot has
+    // an index, and nodes may be built in different slots from different
+    // threads at the same time. `finish_block` hands the block back.
+    class Block {
+    public:
+        bool empty() const {
+            return used.empty();
+        }
+
+        template <typename... Args>
+        NodeT *construct(size_t index, Args &&...args) {
+            used[index] = 1;
+            return new (slots[index].storage) NodeT(std::forward<Args>(args)...);
+        }
+
+    private:
+        friend class NodePool;
+
+        Slot *slots = nullptr;
+        // Not `std::vector<bool>`, whose elements share bytes between threads.
+        std::vector<unsigned char> used;
+    };
+
+    NodePool() = default;
+    NodePool(const NodePool &) = delete;
+    NodePool &operator=(const NodePool &) = delete;
+
+    ~NodePool() {
+        release();
+    }
+
+    template <typename... Args>
+    NodeT *allocate(Args &&...args) {
+        Slot *slot = take_slot();
+        ++live;
+        return new (slot->storage) NodeT(std::forward<Args>(args)...);
+    }
+
+    void deallocate(NodeT *node) {
+        node->~NodeT();
+        Slot *slot = reinterpret_cast<Slot *>(node);
+        slot->next = free_list;
+        free_list = slot;
+        ++free_count;
+        --live;
+    }
+
+    // Frees every slab at once. Every node must already have been destroyed
+    // (or be trivially destructible) before calling this.
+    void release() {
+        slabs.clear();
+        free_list = nullptr;
+        free_count = 0;
+        live = 0;
+        next_unused = 0;
+    }
+
+    // Makes the next `count` allocations come one after the other from a
+    // single slab of exactly that size. The pool must be empty.
+    void reserve_dense(size_t count) {
+        if (count != 0) {
+            add_slab(count);
+        }
+    }
+
+    // Moves every slab into `retired`, leaving the pool empty, so the old
+    // nodes stay readable until `retired` is destroyed.
+    void retire(NodePool &retired) {
+        std::swap(slabs, retired.slabs);
+        std::swap(free_list, retired.free_list);
+        std::swap(free_count, retired.free_count);
+        std::swap(live, retired.live);
+        std::swap(next_unused, retired.next_unused);
+    }
+
+    // Sets aside a new slab of exactly `count` slots, without using up the
+    // rest of the newest slab.
+    Block reserve_block(size_t count) {
+        Block block;
+        if (count == 0) {
+            return block;
+        }
+        Slab slab{std::unique_ptr<Slot[]>(new Slot[count]), count};
+        block.slots = slab.slots.get();
+        block.used.assign(count, 0);
+        if (slabs.empty()) {
+            slabs.push_back(std::move(slab));
+            next_unused = count;
+        } else {
+            slabs.insert(slabs.end() - 1, std::move(slab));
+        }
+        return block;
+    }
+
+    // Counts the nodes built in `block` as live and puts the slots it didn't
+    // use on the free list.
+    void finish_block(Block &block) {
+        for (size_t i = block.used.size(); i-- > 0;) {
+            if (block.used[i]) {
+                ++live;
+                continue;
+            }
+            Slot *slot = &block.slots[i];
+            slot->next = free_list;
+            free_list = slot;
+            ++free_count;
+        }
+        block = Block();
+    }
+
+    MemoryUsage usage() const {
+        MemoryUsage result;
+        result.nodes = live;
+        result.free_slots = free_count;
+        result.unused_slots = slabs.empty() ? 0 : slabs.back().capacity - next_unused;
+        result.slabs = slabs.size();
+        result.node_bytes = live * sizeof(Slot);
+        result.free_bytes = free_count * sizeof(Slot);
+        result.unused_bytes = result.unused_slots * sizeof(Slot);
+        for (const Slab &slab : slabs) {
+            result.slab_bytes += slab.capacity * sizeof(Slot);
+        }
+        result.overhead_bytes = slabs.capacity() * sizeof(Slab);
+        return result;
+    }
+
+private:
+    // The first slab holds this many nodes, and each new slab is twice as big
+    // as the last one, up to `kMaxSlabNodes`.
+    static constexpr size_t kMinSlabNodes = 64;
+    static constexpr size_t kMaxSlabNodes = 1 << 16;
+
+    union Slot {
+        Slot *next;
+        alignas(NodeT) unsigned char storage[sizeof(NodeT)];
+    };
+
+    struct Slab {
+        std::unique_ptr<Slot[]> slots;
+        size_t capacity;
+    };
+
+    Slot *take_slot() {
+        if (free_list != nullptr) {
+            Slot *slot = free_list;
+            free_list = slot->next;
+            --free_count;
+            return slot;
+        }
+        if (slabs.empty() || next_unused == slabs.back().capacity) {
+            size_t capacity = slabs.empty() ? kMinSlabNodes : std::min(slabs.back().capacity * 2, kMaxSlabNodes);
+            add_slab(std::max(capacity, kMinSlabNodes));
+        }
+        return &slabs.back().slots[next_unused++];
+    }
+
+    void add_slab(size_t capacity) {
+        // Not `std::make_unique`, which would zero the whole slab up front.
+        slabs.push_back({std::unique_ptr<Slot[]>(new Slot[capacity]), capacity});
+        next_unused = 0;
+    }
+
+    std::vector<Slab> slabs;
+    Slot *free_list = nullptr;
+    size_t free_count = 0;
+    size_t live = 0;
+    size_t next_unused = 0;
+};
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Small fork/join helpers for the bulk tree operations. They use plain
+// `std::thread`s so they don't depend on a parallel standard library.
+
+// Batches smaller than this aren't worth handing to another thread.
+constexpr size_t kParallelCutoff = 1 << 13;
+
+// The most levels a recursion may fork, whatever it is asked for.
+constexpr int kMaxForkDepth = 16;
+
+// How many levels of a divide-and-conquer recursion should fork, so that the
+// leaves of the forking keep every hardware thread busy.
+inline int fork_depth() {
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    int depth = 0;
+    while (depth < kMaxForkDepth && (1u << depth) < threads) {
+        ++depth;
+    }
+    return depth;
+}
+
+// Runs `first` and `second`, on two threads if `parallel` is true, and
+// returns once both have finished. If another thread can't be started the
+// two run one after the other instead.
+template <typename First, typename Second>
+void fork_join(bool parallel, First &&first, Second &&second) {
+    if (parallel) {
+        std::future<void> forked;
+        try {
+            forked = std::async(std::launch::async, std::forward<First>(first));
+        } catch (const std::system_error &) {
+            parallel = false;
+        }
+        if (parallel) {
+            second();
+            forked.get();
+            return;
+        }
+    }
+    first();
+    second();
+}
+
+// Runs every task in `tasks`, one per thread. If a thread can't be started,
+// the tasks that didn't get one run on the calling thread instead.
+template <typename Task>
+void run_all(std::vector<Task> &tasks) {
+    std::vector<std::thread> workers;
+    size_t started = 0;
+    try {
+        for (; started < tasks.size(); ++started) {
+            workers.emplace_back(tasks[started]);
+        }
+    } catch (const std::system_error &) {
+        for (size_t i = started; i < tasks.size(); ++i) {
+            tasks[i]();
+        }
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+// Sorts `values` by sorting up to 2^`forks` chunks on their own threads and
+// then merging neighbouring chunks in parallel until one is left.
+template <typename T>
+void parallel_sort(std::vector<T> &values, int forks = fork_depth()) {
+    size_t threads = size_t(1) << std::max(0, std::min(forks, kMaxForkDepth));
+    size_t chunks = std::min(threads, values.size() / kParallelCutoff);
+    if (chunks <= 1) {
+        std::sort(values.begin(), values.end());
+        return;
+    }
+
+    std::vector<size_t> bounds(chunks + 1);
+    for (size_t i = 0; i <= chunks; ++i) {
+        bounds[i] = values.size() * i / chunks;
+    }
+
+    std::vector<std::function<void()>> tasks;
+    for (size_t i = 0; i < chunks; ++i) {
+        tasks.push_back([&values, &bounds, i] {
+            std::sort(values.begin() + bounds[i], values.begin() + bounds[i + 1]);
+        });
+    }
+    run_all(tasks);
+
+    for (size_t width = 1; width < chunks; width *= 2) {
+        tasks.clear();
+        for (size_t i = 0; i + width < chunks; i += 2 * width) {
+            size_t first = bounds[i];
+            size_t middle = bounds[i + width];
+            size_t last = bounds[std::min(i + 2 * width, chunks)];
+            tasks.push_back([&values, first, middle, last] {
+                std::inplace_merge(values.begin() + first, values.begin() + middle, values.begin() + last);
+            });
+        }
+        run_all(tasks);
+    }
+}
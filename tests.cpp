@@ -1,8 +1,162 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <mutex>
+#include <new>
+#include <random>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
 #include "AVL.h"
+#include "AugmentedAVLTree.h"
+#include "IntervalTree.h"
 #include "printing.h"
 
+// Each test is a scenario script in `scenarios/` that is run against every
+// tree variant below. The output of a run is captured in memory and compared
+// to the scenario's golden file (one of the `key_file*.txt` files).
+//
+// A scenario script has one step per line. Blank lines and lines starting
+// with `#` are ignored. The steps are:
+//
+//   golden FILE              the file the output must match (required)
+//   echo TEXT                print TEXT and a newline; `\n` in TEXT is a newline
+//   print                    pretty print the tree
+//   insert K                 insert K and print the result
+//   remove K                 remove K and print the result
+//   contains K               print whether the tree contains K
+//   head K                   check that K is the root, then remove it
+//   size                     print the size of the tree
+//   verify                   check the tree's order, heights and balance
+//   clear                    clear the tree without printing anything
+//   compact                  compact the tree's nodes in in-order layout
+//   compact_veb              compact the tree's nodes in van Emde Boas layout
+//   memory                   print the tree's nodes, free and unused slots, slabs and fragmentation
+//   min, max                 print the smallest or largest number in the tree
+//   pop_min, pop_max         remove the smallest or largest number and print it
+//   drain_min, drain_max     pop every number and check they came out in order
+//   sum LO HI                print the sum of the numbers from LO to HI
+//   interval_insert LO HI    insert [LO, HI) into the interval tree and print the result
+//   interval_remove LO HI    remove [LO, HI) from the interval tree and print the result
+//   interval_contains LO HI  print whether the interval tree contains [LO, HI)
+//   interval_size            print how many intervals the interval tree has
+//   interval_verify          check the interval tree's order, balance and largest his
+//   interval_load_random N SEED    insert N pseudo-random intervals
+//   interval_unload_random N SEED  remove the same N pseudo-random intervals
+//   stab P                   print every interval that contains P
+//   overlap LO HI            print every interval that overlaps [LO, HI)
+//   stab_check P             check `stab` against a linear scan
+//   overlap_check LO HI      check `overlap` against a linear scan
+//   cache N                  put a lookup cache with N slots in front of `contains`
+//   cache_stats              print the lookup cache's hits and misses
+//   load K...                insert every K without printing anything
+//   load_sequence LO HI [S]  insert LO, LO + S, ... up to HI (S defaults to 1)
+//   unload_sequence LO HI [S]  remove LO, LO + S, ... up to HI
+//   load_random N SEED       insert N pseudo-random numbers
+//   unload_random N SEED     remove the same N pseudo-random numbers
+//   bulk_load K...           insert every K with one `insert_range` call
+//   bulk_unload K...         remove every K with one `erase_range` call
+//   bulk_load_sequence LO HI [S]    like `load_sequence`, with `insert_range`
+//   bulk_unload_sequence LO HI [S]  like `unload_sequence`, with `erase_range`
+//   bulk_load_random N SEED         like `load_random`, with `insert_range`
+//   bulk_unload_random N SEED       like `unload_random`, with `erase_range`
+//   forks N                  make the bulk steps fork N levels deep (-1 to match the hardware)
+//   hint_load K...           like `load`, passing a handle from one insert to the next
+//   hint_load_sequence LO HI [S]    like `load_sequence`, with a handle
+//   hint_load_random N SEED         like `load_random`, with a handle
+//   find_or_insert K         find or insert K and print which happened
+//   hint_insert K            insert K through a handle kept for the whole scenario
+//   foreign_hint K           insert K into a new tree through a handle from another new tree
+//   reborn_hint K            insert K into a new tree through a handle from an old tree at its address
+//
+// A scenario that uses any of the interval steps (the `interval_` ones,
+// `stab`, `overlap` and their `_check`s) is an interval scenario. It is run
+// against an `IntervalTree` (see `IntervalTree.h`) instead of the trees
+// above, and may only use `echo` besides the interval steps.
+//
+// The `load` and `unload` steps are meant for large-scale scenarios: they
+// don't print anything, so they run without holding the output lock. The
+// `bulk` steps print how many numbers were added or removed. `forks` lets a
+// scenario take their multithreaded paths even on a machine with one CPU.
+
+// -------------------- OUTPUT CAPTURE --------------------
+
+// `printing.h` writes straight to `std::cout`, so `std::cout` gets a buffer
+// that appends to whichever string the current thread is capturing into.
+// The stream's formatting state is still shared between threads, so anything
+// that prints must hold `output_mutex`, through an `OutputLock`.
+thread_local std::string *captured_output = nullptr;
+std::mutex output_mutex;
+
+// How long the current thread has spent waiting for `output_mutex`. A
+// scenario's time leaves this out, since it depends on what the other
+// threads happen to be printing.
+thread_local std::chrono::steady_clock::duration output_wait{};
+
+// Holds `output_mutex` for as long as it is in scope, adding the time spent
+// waiting for it to `output_wait`.
+class OutputLock {
+public:
+    OutputLock() {
+        if (!output_mutex.try_lock()) {
+            auto start = std::chrono::steady_clock::now();
+            output_mutex.lock();
+            output_wait += std::chrono::steady_clock::now() - start;
+        }
+    }
+
+    ~OutputLock() {
+        output_mutex.unlock();
+    }
+
+    OutputLock(const OutputLock &) = delete;
+    OutputLock &operator=(const OutputLock &) = delete;
+};
+
+class CaptureBuffer : public std::streambuf {
+public:
+    explicit CaptureBuffer(std::streambuf *fallback) : fallback(fallback) {}
+
+protected:
+    int_type overflow(int_type ch) override {
+        if (traits_type::eq_int_type(ch, traits_type::eof())) {
+            return traits_type::not_eof(ch);
+        }
+        if (captured_output == nullptr) {
+            return fallback->sputc(traits_type::to_char_type(ch));
+        }
+        captured_output->push_back(traits_type::to_char_type(ch));
+        return ch;
+    }
+
+    std::streamsize xsputn(const char *text, std::streamsize count) override {
+        if (captured_output == nullptr) {
+            return fallback->sputn(text, count);
+        }
+        captured_output->append(text, static_cast<size_t>(count));
+        return count;
+    }
+
+    int sync() override {
+        return captured_output == nullptr ? fallback->pubsync() : 0;
+    }
+
+private:
+    std::streambuf *fallback;
+};
+
+// -------------------- STEP HELPERS --------------------
+
 void pretty_print_with_header(const AVLInterface &tree) {
     std::cout << "Pretty printing the tree...\n" << std::endl;
     pretty_print_tree(tree);
@@ -34,597 +188,952 @@ void print_size(const AVLInterface &tree) {
     std::cout << "tree.size() = " << tree.size() << std::endl;
 }
 
-void test1() {
-    std::cout << "--- Test 1 output ---\n" << std::endl;
-
-    AVL tree;
-
-    pretty_print_with_header(tree);
-
-    insert_with_message(tree, 1);
-    pretty_print_with_header(tree);
-
-    insert_with_message(tree, 2);
-    pretty_print_with_header(tree);
-
-    insert_with_message(tree, 3);
-    pretty_print_with_header(tree);
+template <typename Tree>
+void find_or_insert_with_message(Tree &tree, int item) {
+    typename Tree::Handle handle;
+    bool inserted = tree.find_or_insert(handle, item);
+    std::cout << "\nFinding or inserting " << item << "..." << (inserted ? "inserted" : "found")
+              << ", handle points to " << handle.node()->data << std::endl;
 }
 
-void test2() {
-    std::cout << "--- Test 2 output ---\n" << std::endl;
-
-    AVL tree;
-
-    pretty_print_with_header(tree);
-
-    insert_with_message(tree, 3);
-    pretty_print_with_header(tree);
-
-    insert_with_message(tree, 2);
-    pretty_print_with_header(tree);
-
-    insert_with_message(tree, 1);
-    pretty_print_with_header(tree);
+template <typename Tree>
+void hint_insert_with_message(Tree &tree, typename Tree::Handle &hint, int item) {
+    bool inserted = tree.insert(hint, item);
+    std::cout << "\nInserting " << item << " through the saved handle..." << std::boolalpha << inserted
+              << ", handle points to " << hint.node()->data << std::endl;
 }
 
-void test3() {
-    std::cout << "--- Test 3 output ---\n" << std::endl;
-
-    AVL tree;
-
-    pretty_print_with_header(tree);
-
-    std::cout << "\nInserting 4, 5, 3, and 2 into the tree..." << std::endl;
-    tree.insert(4);
-    tree.insert(5);
-    tree.insert(3);
-    tree.insert(2);
-
-    pretty_print_with_header(tree);
-
-    insert_with_message(tree, 1);
-    pretty_print_with_header(tree);
+// Passes a handle from one tree to another that has had as many changes. The
+// second tree must ignore the handle's path and insert `item` into itself.
+template <typename Tree>
+void foreign_hint_with_message(int item) {
+    Tree other;
+    Tree tree;
+    typename Tree::Handle hint;
+    other.find_or_insert(hint, item - 1);
+    tree.insert(item + 1);
+    bool inserted = tree.insert(hint, item);
+    std::cout << "\nInserting " << item << " into a tree through another tree's handle..." << std::boolalpha
+              << inserted << ", handle points to " << hint.node()->data << std::endl;
+    std::cout << "  tree: size " << tree.size() << ", contains " << item << " = " << tree.contains(item)
+              << "; other tree: size " << other.size() << ", contains " << item << " = " << other.contains(item)
+              << std::endl;
 }
 
-void test4() {
-    std::cout << "--- Test 4 output ---\n" << std::endl;
-
-    AVL tree;
-
-    pretty_print_with_header(tree);
-
-    std::cout << "\nInserting 4, 5, 3, and 1 into the tree..." << std::endl;
-    tree.insert(4);
-    tree.insert(5);
-    tree.insert(3);
-    tree.insert(1);
-
-    pretty_print_with_header(tree);
+// Takes a handle from a tree, destroys the tree, builds a new one in the same
+// memory with as many changes, and inserts `item` through the old handle,
+// which must not lead into the old tree's freed nodes.
+template <typename Tree>
+void reborn_hint_with_message(int item) {
+    alignas(Tree) unsigned char memory[sizeof(Tree)];
+    Tree *tree = new (memory) Tree();
+    for (int value = 1; value <= 50; ++value) {
+        tree->insert(item + value);
+    }
+    typename Tree::Handle hint;
+    tree->find_or_insert(hint, item - 1);
+    tree->~Tree();
 
-    insert_with_message(tree, 2);
-    pretty_print_with_header(tree);
+    tree = new (memory) Tree();
+    for (int value = 1; value <= 51; ++value) {
+        tree->insert(item + 1000 + value);
+    }
+    bool inserted = tree->insert(hint, item);
+    std::cout << "\nInserting " << item << " into a new tree through a handle from an old tree at the same address..."
+              << std::boolalpha << inserted << std::endl;
+    std::cout << "  tree: size " << tree->size() << ", contains " << item << " = " << tree->contains(item)
+              << std::endl;
+    tree->~Tree();
 }
 
-void test5() {
-    std::cout << "--- Test 5 output ---\n" << std::endl;
-
-    AVL tree;
-
-    pretty_print_with_header(tree);
-
-    std::cout << "\nInserting 2, 1, 3, and 4 into the tree..." << std::endl;
-    tree.insert(2);
-    tree.insert(1);
-    tree.insert(3);
-    tree.insert(4);
-
-    pretty_print_with_header(tree);
-
-    insert_with_message(tree, 5);
-    pretty_print_with_header(tree);
+void bulk_insert_with_message(size_t items, int added) {
+    std::cout << "\nInserting a batch of " << items << " numbers into the tree..." << added << " added"
+              << std::endl;
 }
 
-void test6() {
-    std::cout << "--- Test 6 output ---\n" << std::endl;
-
-    AVL tree;
-
-    pretty_print_with_header(tree);
-
-    std::cout << "\nInserting 2, 1, 3, and 5 into the tree..." << std::endl;
-    tree.insert(2);
-    tree.insert(1);
-    tree.insert(3);
-    tree.insert(5);
-
-    pretty_print_with_header(tree);
-
-    insert_with_message(tree, 4);
-    pretty_print_with_header(tree);
+void bulk_remove_with_message(size_t items, int removed) {
+    std::cout << "\nRemoving a batch of " << items << " numbers from the tree..." << removed << " removed"
+              << std::endl;
 }
 
-void test7() {
-    std::cout << "--- Test 7 output ---\n" << std::endl;
-
-    AVL tree;
-
-    pretty_print_with_header(tree);
-
-    std::cout << "\nInserting 4, 2, 8, 1, 3, 6, 10, 5, 7, 9, and 11 into the tree..." << std::endl;
-    tree.insert(4);
-    tree.insert(2);
-    tree.insert(8);
-    tree.insert(1);
-    tree.insert(3);
-    tree.insert(6);
-    tree.insert(10);
-    tree.insert(5);
-    tree.insert(7);
-    tree.insert(9);
-    tree.insert(11);
-
-    pretty_print_with_header(tree);
-
-    insert_with_message(tree, 12);
-    pretty_print_with_header(tree);
+// Prints the slab sizes in slots rather than bytes, so the output doesn't
+// depend on how big a node is.
+void print_memory_usage(const MemoryUsage &usage, size_t slot_bytes) {
+    std::ostringstream fragmentation;
+    fragmentation << std::fixed << std::setprecision(3) << usage.fragmentation();
+    std::cout << "tree.memory_usage() = " << usage.nodes << " nodes, " << usage.free_slots << " free slots, "
+              << usage.unused_slots << " unused slots, " << usage.slabs << " slabs of "
+              << usage.slab_bytes / slot_bytes << " slots, fragmentation " << fragmentation.str() << std::endl;
+    bool adds_up = usage.slab_bytes == usage.node_bytes + usage.free_bytes + usage.unused_bytes &&
+                   usage.slab_bytes % slot_bytes == 0 && usage.node_bytes == usage.nodes * slot_bytes;
+    if (!adds_up) {
+        std::cout << "  the byte counts don't add up" << std::endl;
+    }
 }
 
-void test8() {
-    std::cout << "--- Test 8 output ---\n" << std::endl;
-
-    AVL tree;
-
-    pretty_print_with_header(tree);
-
-    std::cout << "\nInserting 4, 2, 9, 1, 3, 6, 11, 5, 7, 10, and 12 into the tree..." << std::endl;
-    tree.insert(4);
-    tree.insert(2);
-    tree.insert(9);
-    tree.insert(1);
-    tree.insert(3);
-    tree.insert(6);
-    tree.insert(11);
-    tree.insert(5);
-    tree.insert(7);
-    tree.insert(10);
-    tree.insert(12);
-
-    pretty_print_with_header(tree);
-
-    insert_with_message(tree, 8);
-    pretty_print_with_header(tree);
+template <typename Tree>
+void print_end(const Tree &tree, bool smallest) {
+    const Node *node = smallest ? tree.min() : tree.max();
+    std::cout << "tree." << (smallest ? "min" : "max") << "() = ";
+    if (node == nullptr) {
+        std::cout << "nullptr" << std::endl;
+    } else {
+        std::cout << node->data << std::endl;
+    }
 }
 
-void test9() {
-    std::cout << "--- Test 9 output ---\n" << std::endl;
-
-    AVL tree;
-
-    pretty_print_with_header(tree);
-
-    std::cout << "\nInserting 9, 5, 11, 3, 7, 10, 12, 2, 4, 6, and 8 into the tree..." << std::endl;
-    tree.insert(9);
-    tree.insert(5);
-    tree.insert(11);
-    tree.insert(3);
-    tree.insert(7);
-    tree.insert(10);
-    tree.insert(12);
-    tree.insert(2);
-    tree.insert(4);
-    tree.insert(6);
-    tree.insert(8);
-
-    pretty_print_with_header(tree);
-
-    insert_with_message(tree, 1);
-    pretty_print_with_header(tree);
+template <typename Tree>
+void pop_with_message(Tree &tree, bool smallest) {
+    int data = 0;
+    bool popped = smallest ? tree.pop_min(data) : tree.pop_max(data);
+    std::cout << "\nPopping the " << (smallest ? "smallest" : "largest") << " number from the tree...";
+    if (popped) {
+        std::cout << data << std::endl;
+    } else {
+        std::cout << "the tree is empty" << std::endl;
+    }
 }
 
-void test10() {
-    std::cout << "--- Test 10 output ---\n" << std::endl;
-
-    AVL tree;
-
-    pretty_print_with_header(tree);
-
-    std::cout << "\nInserting 9, 4, 11, 2, 7, 10, 12, 1, 3, 5, and 8 into the tree..." << std::endl;
-    tree.insert(9);
-    tree.insert(4);
-    tree.insert(11);
-    tree.insert(2);
-    tree.insert(7);
-    tree.insert(10);
-    tree.insert(12);
-    tree.insert(1);
-    tree.insert(3);
-    tree.insert(5);
-    tree.insert(8);
-
-    pretty_print_with_header(tree);
-
-    insert_with_message(tree, 6);
-    pretty_print_with_header(tree);
+template <typename Tree>
+void drain_with_message(Tree &tree, bool smallest) {
+    int popped = 0;
+    bool in_order = true;
+    int previous = 0;
+    int data = 0;
+    while (smallest ? tree.pop_min(data) : tree.pop_max(data)) {
+        if (popped > 0 && (smallest ? data <= previous : data >= previous)) {
+            in_order = false;
+        }
+        previous = data;
+        ++popped;
+    }
+    std::cout << "\nPopping every number from the tree, " << (smallest ? "smallest" : "largest") << " first..."
+              << popped << " popped, in order = " << std::boolalpha << in_order << std::endl;
 }
 
-void test11() {
-    std::cout << "--- Test 11 output ---\n" << std::endl;
-
-    AVL tree;
-
-    pretty_print_with_header(tree);
-
-    std::cout << "\nInserting 8, 4, 12, 2, 6, 10, 14, 1, 3, 5,\n          9, 11, 13, and 15 into the tree..."
+void print_lookup_cache_stats(const LookupCacheStats &stats) {
+    std::cout << "tree.lookup_cache_stats() = " << stats.hits << " hits, " << stats.misses << " misses"
               << std::endl;
-    tree.insert(8);
-    tree.insert(4);
-    tree.insert(12);
-    tree.insert(2);
-    tree.insert(6);
-    tree.insert(10);
-    tree.insert(14);
-    tree.insert(1);
-    tree.insert(3);
-    tree.insert(5);
-    tree.insert(9);
-    tree.insert(11);
-    tree.insert(13);
-    tree.insert(15);
-
-    pretty_print_with_header(tree);
-    std::cout << std::endl;
-
-    contains_with_message(tree, 14);
-    contains_with_message(tree, 4);
-    contains_with_message(tree, 5);
-    contains_with_message(tree, 15);
-    contains_with_message(tree, 7);
-    contains_with_message(tree, 2);
-    contains_with_message(tree, -3);
-    contains_with_message(tree, 17);
-    contains_with_message(tree, 35);
 }
 
-void test12() {
-    std::cout << "--- Test 12 output ---\n" << std::endl;
+// Checks the subtree rooted at `node` and returns its height, or -1 (with
+// `problem` filled in) if something is wrong with it.
+int verify_subtree(const Node *node, const int *lower, const int *upper, int &nodes, std::string &problem) {
+    if (node == nullptr) {
+        return 0;
+    }
+    ++nodes;
+    if ((lower != nullptr && node->data <= *lower) || (upper != nullptr && node->data >= *upper)) {
+        problem = std::to_string(node->data) + " is out of order";
+        return -1;
+    }
+    int left = verify_subtree(node->left, lower, &node->data, nodes, problem);
+    if (left < 0) {
+        return -1;
+    }
+    int right = verify_subtree(node->right, &node->data, upper, nodes, problem);
+    if (right < 0) {
+        return -1;
+    }
+    if (node->height != std::max(left, right) + 1) {
+        problem = std::to_string(node->data) + " has the wrong height";
+        return -1;
+    }
+    if (left - right > 1 || right - left > 1) {
+        problem = std::to_string(node->data) + " is out of balance";
+        return -1;
+    }
+    return node->height;
+}
 
-    AVL tree;
+// Whether `Tree` keeps an aggregate in each node (see `AugmentedAVLTree.h`).
+template <typename Tree, typename = void>
+struct is_augmented : std::false_type {};
 
-    pretty_print_with_header(tree);
+template <typename Tree>
+struct is_augmented<Tree, std::void_t<typename Tree::monoid_type>> : std::true_type {};
 
-    std::cout << "Inserting 6, 4, 7, 2, 5, 9, 1, and 3 into the tree..." << std::endl;
-    tree.insert(6);
-    tree.insert(4);
-    tree.insert(7);
-    tree.insert(2);
-    tree.insert(5);
-    tree.insert(9);
-    tree.insert(1);
-    tree.insert(3);
+// Whether `Tree` keeps the sum of each subtree.
+template <typename Tree, typename = void>
+struct keeps_sums : std::false_type {};
 
-    pretty_print_with_header(tree);
+template <typename Tree>
+struct keeps_sums<Tree, std::enable_if_t<std::is_same<typename Tree::monoid_type, SumMonoid>::value>>
+    : std::true_type {};
 
-    remove_with_message(tree, 9);
-    pretty_print_with_header(tree);
+// Checks every aggregate in the subtree rooted at `node`, and returns the
+// subtree's aggregate.
+template <typename Tree>
+typename Tree::value_type verify_aggregates(const Node *node, std::string &problem) {
+    using Monoid = typename Tree::monoid_type;
+    if (node == nullptr) {
+        return Monoid::identity();
+    }
+    typename Tree::value_type expected =
+        Monoid::combine(Monoid::combine(verify_aggregates<Tree>(node->left, problem), Monoid::lift(node->data)),
+                        verify_aggregates<Tree>(node->right, problem));
+    if (problem.empty() && Tree::aggregate(node) != expected) {
+        problem = std::to_string(node->data) + " has the wrong aggregate";
+    }
+    return expected;
 }
 
-void test13() {
-    std::cout << "--- Test 13 output ---\n" << std::endl;
-
-    AVL tree;
-
-    pretty_print_with_header(tree);
+template <typename Tree>
+void verify_with_message(const AVLAdapter<Tree> &adapter) {
+    const Tree &tree = adapter.static_tree();
+    int nodes = 0;
+    std::string problem;
+    Node *root = tree.getRootNode();
+    if (verify_subtree(root, nullptr, nullptr, nodes, problem) >= 0 && nodes != tree.size()) {
+        problem = "tree.size() is " + std::to_string(tree.size()) + " but the tree has " + std::to_string(nodes) +
+                  " nodes";
+    }
 
-    std::cout << "Inserting 6, 2, 7, 1, 4, 9, 3, and 5 into the tree..." << std::endl;
-    tree.insert(6);
-    tree.insert(2);
-    tree.insert(7);
-    tree.insert(1);
-    tree.insert(4);
-    tree.insert(9);
-    tree.insert(3);
-    tree.insert(5);
+    Node *leftmost = root;
+    Node *rightmost = root;
+    while (leftmost != nullptr && leftmost->left != nullptr) {
+        leftmost = leftmost->left;
+    }
+    while (rightmost != nullptr && rightmost->right != nullptr) {
+        rightmost = rightmost->right;
+    }
+    if (problem.empty() && (tree.min() != leftmost || tree.max() != rightmost)) {
+        problem = "tree.min() or tree.max() isn't the smallest or largest node";
+    }
 
-    pretty_print_with_header(tree);
+    if constexpr (is_augmented<Tree>::value) {
+        if (problem.empty()) {
+            verify_aggregates<Tree>(root, problem);
+        }
+    }
 
-    remove_with_message(tree, 9);
-    pretty_print_with_header(tree);
+    std::cout << "Checking that the tree is a valid AVL tree..." << std::boolalpha << problem.empty() << std::endl;
+    if (!problem.empty()) {
+        std::cout << "  " << problem << std::endl;
+    }
 }
 
-void test14() {
-    std::cout << "--- Test 14 output ---\n" << std::endl;
-
-    AVL tree;
-
-    pretty_print_with_header(tree);
+long long sum_subtree(const Node *node, int lo, int hi) {
+    if (node == nullptr) {
+        return 0;
+    }
+    long long sum = node->data >= lo && node->data <= hi ? node->data : 0;
+    if (node->data > lo) {
+        sum += sum_subtree(node->left, lo, hi);
+    }
+    if (node->data < hi) {
+        sum += sum_subtree(node->right, lo, hi);
+    }
+    return sum;
+}
 
-    std::cout << "Inserting 4, 3, 8, 2, 6, 9, 5, and 7 into the tree..." << std::endl;
-    tree.insert(4);
-    tree.insert(3);
-    tree.insert(8);
-    tree.insert(2);
-    tree.insert(6);
-    tree.insert(9);
-    tree.insert(5);
-    tree.insert(7);
+// Trees that keep sums answer with `reduce`. Any other tree is walked.
+template <typename Tree>
+void sum_with_message(const Tree &tree, int lo, int hi) {
+    long long sum = 0;
+    if constexpr (keeps_sums<Tree>::value) {
+        sum = tree.reduce(lo, hi);
+    } else {
+        sum = sum_subtree(tree.getRootNode(), lo, hi);
+    }
+    std::cout << "Sum of the numbers from " << lo << " to " << hi << " = " << sum << std::endl;
+}
 
-    pretty_print_with_header(tree);
+// The values `load_random` and `unload_random` use. `std::mt19937` produces
+// the same sequence on every standard library, so the golden files can rely
+// on it.
+std::vector<int> random_values(int count, int seed) {
+    std::mt19937 engine(static_cast<std::mt19937::result_type>(seed));
+    std::vector<int> values(static_cast<size_t>(count));
+    for (int &value : values) {
+        value = static_cast<int>(engine() % 2000000);
+    }
+    return values;
+}
 
-    remove_with_message(tree, 2);
-    pretty_print_with_header(tree);
+// -------------------- SCENARIOS --------------------
+
+struct Step {
+    std::string op;
+    std::vector<int> args;
+    std::string text;
+};
+
+struct Scenario {
+    std::string name;
+    std::string golden_path;
+    std::vector<Step> steps;
+    bool intervals = false;
+};
+
+std::string unescape(const std::string &text) {
+    std::string result;
+    for (size_t i = 0; i < text.size(); ++i) {
+        if (text[i] == '\\' && i + 1 < text.size() && text[i + 1] == 'n') {
+            result += '\n';
+            ++i;
+        } else {
+            result += text[i];
+        }
+    }
+    return result;
 }
 
-void test15() {
-    std::cout << "--- Test 15 output ---\n" << std::endl;
+bool is_interval_step(const std::string &op) {
+    return op.compare(0, 9, "interval_") == 0 || op == "stab" || op == "overlap" || op == "stab_check" ||
+           op == "overlap_check";
+}
 
-    AVL tree;
+// Returns how many integer arguments `op` takes as {min, max}, or {-1, -1}
+// if `op` isn't a step.
+std::pair<int, int> argument_count(const std::string &op) {
+    if (op == "print" || op == "size" || op == "verify" || op == "clear" || op == "compact" || op == "compact_veb" ||
+        op == "memory" || op == "cache_stats" || op == "min" || op == "max" || op == "pop_min" ||
+        op == "pop_max" || op == "drain_min" || op == "drain_max") {
+        return {0, 0};
+    }
+    if (op == "insert" || op == "remove" || op == "contains" || op == "head" || op == "find_or_insert" ||
+        op == "hint_insert" || op == "foreign_hint" || op == "reborn_hint" || op == "cache" || op == "forks") {
+        return {1, 1};
+    }
+    if (op.compare(0, 5, "bulk_") == 0) {
+        std::pair<int, int> unbulked = argument_count(op.substr(5));
+        return op == "bulk_unload" ? std::make_pair(1, 1 << 30) : unbulked;
+    }
+    if (op.compare(0, 9, "hint_load") == 0) {
+        return argument_count(op.substr(5));
+    }
+    if (op == "load") {
+        return {1, 1 << 30};
+    }
+    if (op == "sum" || op == "interval_insert" || op == "interval_remove" || op == "interval_contains" ||
+        op == "interval_load_random" || op == "interval_unload_random" || op == "overlap" || op == "overlap_check") {
+        return {2, 2};
+    }
+    if (op == "stab" || op == "stab_check") {
+        return {1, 1};
+    }
+    if (op == "interval_size" || op == "interval_verify") {
+        return {0, 0};
+    }
+    if (op == "load_sequence" || op == "unload_sequence") {
+        return {2, 3};
+    }
+    if (op == "load_random" || op == "unload_random") {
+        return {2, 2};
+    }
+    return {-1, -1};
+}
 
-    pretty_print_with_header(tree);
+// Reads the scenario at `path`. Returns false (with `error` filled in) if the
+// file can't be read or has a bad step in it.
+bool parse_scenario(const std::filesystem::path &path, const std::filesystem::path &dir, Scenario &scenario,
+                    std::string &error) {
+    std::ifstream file(path);
+    if (!file) {
+        error = "cannot open " + path.string();
+        return false;
+    }
 
-    std::cout << "Inserting 4, 3, 6, 2, 5, 8, 7, and 9 into the tree..." << std::endl;
-    tree.insert(4);
-    tree.insert(3);
-    tree.insert(6);
-    tree.insert(2);
-    tree.insert(5);
-    tree.insert(8);
-    tree.insert(7);
-    tree.insert(9);
+    scenario.name = path.stem().string();
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line)) {
+        ++line_number;
+        std::string where = path.string() + ":" + std::to_string(line_number) + ": ";
+
+        std::istringstream words(line);
+        Step step;
+        if (!(words >> step.op) || step.op[0] == '#') {
+            continue;
+        }
+        if (step.op == "golden" || step.op == "echo") {
+            std::string rest;
+            std::getline(words, rest);
+            rest.erase(0, std::min(rest.size(), size_t{1}));
+            if (step.op == "golden") {
+                scenario.golden_path = (dir / rest).string();
+                continue;
+            }
+            step.text = unescape(rest);
+            scenario.steps.push_back(step);
+            continue;
+        }
+
+        std::pair<int, int> expected = argument_count(step.op);
+        if (expected.first < 0) {
+            error = where + "unknown step '" + step.op + "'";
+            return false;
+        }
+        std::string word;
+        while (words >> word) {
+            try {
+                size_t used = 0;
+                step.args.push_back(std::stoi(word, &used));
+                if (used != word.size()) {
+                    throw std::invalid_argument(word);
+                }
+            } catch (const std::exception &) {
+                error = where + "'" + word + "' is not an integer";
+                return false;
+            }
+        }
+        int given = static_cast<int>(step.args.size());
+        if (given < expected.first || given > expected.second) {
+            error = where + "wrong number of arguments to '" + step.op + "'";
+            return false;
+        }
+        // A sequence with a stride below 1 would never reach its end, and a
+        // random load can't make a negative number of values.
+        bool sequence = step.op.find("load_sequence") != std::string::npos;
+        bool random = step.op.find("load_random") != std::string::npos;
+        if (sequence && given > 2 && step.args[2] <= 0) {
+            error = where + "the stride of '" + step.op + "' must be positive";
+            return false;
+        }
+        if (random && step.args[0] < 0) {
+            error = where + "the count of '" + step.op + "' can't be negative";
+            return false;
+        }
+        scenario.steps.push_back(step);
+    }
 
-    pretty_print_with_header(tree);
+    if (scenario.golden_path.empty()) {
+        error = path.string() + ": missing 'golden' line";
+        return false;
+    }
 
-    remove_with_message(tree, 2);
-    pretty_print_with_header(tree);
+    // An interval scenario can't use the other trees' steps.
+    for (const Step &step : scenario.steps) {
+        scenario.intervals = scenario.intervals || is_interval_step(step.op);
+    }
+    for (const Step &step : scenario.steps) {
+        if (scenario.intervals && step.op != "echo" && !is_interval_step(step.op)) {
+            error = path.string() + ": '" + step.op + "' can't be used with the interval steps";
+            return false;
+        }
+    }
+    return true;
 }
 
-void test16() {
-    std::cout << "--- Test 16 output ---\n" << std::endl;
-
-    AVL tree;
-
-    pretty_print_with_header(tree);
-
-    std::cout << "Inserting 10, 6, 14, 4, 8, 12, 16, 2, 5, 7, 11, 13, 15, 17, 1, and 3 into the tree..." << std::endl;
-    tree.insert(10);
-    tree.insert(6);
-    tree.insert(14);
-    tree.insert(4);
-    tree.insert(8);
-    tree.insert(12);
-    tree.insert(16);
-    tree.insert(2);
-    tree.insert(5);
-    tree.insert(7);
-    tree.insert(11);
-    tree.insert(13);
-    tree.insert(15);
-    tree.insert(17);
-    tree.insert(1);
-    tree.insert(3);
+// The numbers a `load`, `unload` or `bulk` step works on.
+std::vector<int> step_values(const Step &step) {
+    const std::vector<int> &args = step.args;
+    bool prefixed = step.op.compare(0, 5, "bulk_") == 0 || step.op.compare(0, 5, "hint_") == 0;
+    std::string op = prefixed ? step.op.substr(5) : step.op;
+
+    if (op == "load_sequence" || op == "unload_sequence") {
+        std::vector<int> values;
+        int stride = args.size() > 2 ? args[2] : 1;
+        for (int64_t value = args[0]; value <= args[1]; value += stride) {
+            values.push_back(static_cast<int>(value));
+        }
+        return values;
+    }
+    if (op == "load_random" || op == "unload_random") {
+        return random_values(args[0], args[1]);
+    }
+    return args;
+}
 
-    pretty_print_with_header(tree);
+// -------------------- INTERVAL STEP HELPERS --------------------
 
-    remove_with_message(tree, 10);
-    pretty_print_with_header(tree);
+// The intervals `interval_load_random` and `interval_unload_random` use: each starts below 2000000 and is
+// 1 to 1000 long.
+std::vector<Interval> random_intervals(int count, int seed) {
+    std::vector<int> values = random_values(2 * count, seed);
+    std::vector<Interval> intervals;
+    for (size_t i = 0; i + 1 < values.size(); i += 2) {
+        intervals.push_back({values[i], values[i] + 1 + values[i + 1] % 1000});
+    }
+    return intervals;
+}
 
-    check_and_remove_head_with_message(tree, 8);
-    check_and_remove_head_with_message(tree, 7);
-    check_and_remove_head_with_message(tree, 6);
-    check_and_remove_head_with_message(tree, 5);
-    check_and_remove_head_with_message(tree, 4);
-    check_and_remove_head_with_message(tree, 3);
-    check_and_remove_head_with_message(tree, 14);
-    check_and_remove_head_with_message(tree, 13);
-    check_and_remove_head_with_message(tree, 12);
-    check_and_remove_head_with_message(tree, 11);
-    check_and_remove_head_with_message(tree, 2);
-    remove_with_message(tree, 13);
-    check_and_remove_head_with_message(tree, 16);
-    check_and_remove_head_with_message(tree, 15);
-    remove_with_message(tree, 3);
-    check_and_remove_head_with_message(tree, 1);
-    check_and_remove_head_with_message(tree, 17);
+// The intervals a `stab` or `overlap` step asks about, sorted. A `stab` is
+// the same as an `overlap` with the range [P, P + 1).
+std::vector<Interval> query_intervals(const IntervalTree &intervals, int lo, int hi, bool stab) {
+    std::vector<Interval> found;
+    auto report = [&found](const Interval &interval) { found.push_back(interval); };
+    if (stab) {
+        intervals.stab(lo, report);
+    } else {
+        intervals.overlap(lo, hi, report);
+    }
+    std::sort(found.begin(), found.end());
+    return found;
+}
 
+void print_query(const IntervalTree &intervals, int lo, int hi, bool stab) {
+    if (stab) {
+        std::cout << "Intervals containing " << lo << ":";
+    } else {
+        std::cout << "Intervals overlapping " << Interval{lo, hi} << ":";
+    }
+    std::vector<Interval> found = query_intervals(intervals, lo, hi, stab);
+    if (found.empty()) {
+        std::cout << " none";
+    }
+    for (const Interval &interval : found) {
+        std::cout << ' ' << interval;
+    }
     std::cout << std::endl;
-    pretty_print_with_header(tree);
 }
 
-void test17() {
-    std::cout << "--- Test 17 output ---\n" << std::endl;
-
-    AVL tree;
-
-    print_size(tree);
-
-    insert_with_message(tree, 1);
-    print_size(tree);
-
-    insert_with_message(tree, 2);
-    print_size(tree);
-
-    insert_with_message(tree, 3);
-    print_size(tree);
-
-    insert_with_message(tree, 4);
-    print_size(tree);
-
-    insert_with_message(tree, 5);
-    print_size(tree);
-
-    insert_with_message(tree, 6);
-    print_size(tree);
-
-    insert_with_message(tree, 7);
-    print_size(tree);
-
-    insert_with_message(tree, 3);
-    print_size(tree);
+void check_query(const IntervalTree &intervals, int lo, int hi, bool stab) {
+    std::vector<Interval> expected;
+    intervals.for_each([&](const Interval &interval) {
+        if (interval.lo < (stab ? lo + 1 : hi) && interval.hi > lo) {
+            expected.push_back(interval);
+        }
+    });
+    std::sort(expected.begin(), expected.end());
+    std::vector<Interval> found = query_intervals(intervals, lo, hi, stab);
+
+    if (stab) {
+        std::cout << "Checking the intervals containing " << lo;
+    } else {
+        std::cout << "Checking the intervals overlapping " << Interval{lo, hi};
+    }
+    std::cout << " against a linear scan..." << found.size() << " found, same = " << std::boolalpha
+              << (found == expected) << std::endl;
+}
 
-    insert_with_message(tree, 8);
-    print_size(tree);
+// Checks the largest `hi` of every subtree, and returns the subtree's.
+int verify_max_his(const Node *node, std::string &problem) {
+    if (node == nullptr) {
+        return INT_MIN;
+    }
+    const std::vector<int> &his = static_cast<const IntervalNode *>(node)->his;
+    int expected = std::max({his.empty() ? INT_MIN : his.front(), verify_max_his(node->left, problem),
+                             verify_max_his(node->right, problem)});
+    if (problem.empty() && his.empty()) {
+        problem = std::to_string(node->data) + " has no intervals";
+    }
+    if (problem.empty() && !std::is_sorted(his.begin(), his.end(), std::greater<int>())) {
+        problem = std::to_string(node->data) + " has its intervals out of order";
+    }
+    if (problem.empty() && IntervalTree::max_hi(node) != expected) {
+        problem = std::to_string(node->data) + " has the wrong largest hi";
+    }
+    return expected;
+}
 
-    insert_with_message(tree, 9);
-    print_size(tree);
+void verify_intervals_with_message(const IntervalTree &intervals) {
+    int nodes = 0;
+    std::string problem;
+    if (verify_subtree(intervals.getRootNode(), nullptr, nullptr, nodes, problem) >= 0) {
+        verify_max_his(intervals.getRootNode(), problem);
+    }
+    std::cout << "Checking that the interval tree is valid..." << std::boolalpha << problem.empty() << std::endl;
+    if (!problem.empty()) {
+        std::cout << "  " << problem << std::endl;
+    }
+}
 
-    insert_with_message(tree, 5);
-    print_size(tree);
+// -------------------- RUNNING STEPS --------------------
 
-    insert_with_message(tree, 10);
-    print_size(tree);
+void run_interval_step(IntervalTree &intervals, const Step &step) {
+    const std::vector<int> &args = step.args;
 
-    insert_with_message(tree, 8);
-    print_size(tree);
+    if (step.op == "interval_load_random") {
+        for (const Interval &interval : random_intervals(args[0], args[1])) {
+            intervals.insert(interval.lo, interval.hi);
+        }
+        return;
+    }
+    if (step.op == "interval_unload_random") {
+        for (const Interval &interval : random_intervals(args[0], args[1])) {
+            intervals.remove(interval.lo, interval.hi);
+        }
+        return;
+    }
 
-    insert_with_message(tree, 10);
-    print_size(tree);
+    OutputLock lock;
+    if (step.op == "echo") {
+        std::cout << step.text << std::endl;
+    } else if (step.op == "interval_insert") {
+        std::cout << "\nAttempting to insert " << Interval{args[0], args[1]} << " into the interval tree..."
+                  << std::boolalpha << intervals.insert(args[0], args[1]) << std::endl;
+    } else if (step.op == "interval_remove") {
+        std::cout << "\nAttempting to remove " << Interval{args[0], args[1]} << " from the interval tree..."
+                  << std::boolalpha << intervals.remove(args[0], args[1]) << std::endl;
+    } else if (step.op == "interval_contains") {
+        std::cout << "intervals.contains(" << Interval{args[0], args[1]} << ") = " << std::boolalpha
+                  << intervals.contains(args[0], args[1]) << std::endl;
+    } else if (step.op == "interval_size") {
+        std::cout << "intervals.size() = " << intervals.size() << std::endl;
+    } else if (step.op == "interval_verify") {
+        verify_intervals_with_message(intervals);
+    } else if (step.op == "stab" || step.op == "overlap") {
+        print_query(intervals, args[0], args.size() > 1 ? args[1] : args[0], step.op == "stab");
+    } else if (step.op == "stab_check" || step.op == "overlap_check") {
+        check_query(intervals, args[0], args.size() > 1 ? args[1] : args[0], step.op == "stab_check");
+    }
+}
 
-    remove_with_message(tree, 4);
-    print_size(tree);
+template <typename Tree>
+void run_step(AVLAdapter<Tree> &tree, typename Tree::Handle &hint, const Step &step) {
+    const std::vector<int> &args = step.args;
 
-    remove_with_message(tree, 7);
-    print_size(tree);
+    if (step.op.compare(0, 4, "load") == 0) {
+        for (int value : step_values(step)) {
+            tree.insert(value);
+        }
+        return;
+    }
+    if (step.op.compare(0, 6, "unload") == 0) {
+        for (int value : step_values(step)) {
+            tree.remove(value);
+        }
+        return;
+    }
+    if (step.op.compare(0, 9, "hint_load") == 0) {
+        typename Tree::Handle handle;
+        for (int value : step_values(step)) {
+            tree.static_tree().insert(handle, value);
+        }
+        return;
+    }
+    if (step.op.compare(0, 9, "bulk_load") == 0) {
+        std::vector<int> values = step_values(step);
+        int added = tree.static_tree().insert_range(values.begin(), values.end());
+        OutputLock lock;
+        bulk_insert_with_message(values.size(), added);
+        return;
+    }
+    if (step.op.compare(0, 11, "bulk_unload") == 0) {
+        std::vector<int> values = step_values(step);
+        int removed = tree.static_tree().erase_range(values.begin(), values.end());
+        OutputLock lock;
+        bulk_remove_with_message(values.size(), removed);
+        return;
+    }
+    if (step.op == "clear") {
+        tree.clear();
+        return;
+    }
+    if (step.op == "cache") {
+        tree.static_tree().enable_lookup_cache(static_cast<size_t>(std::max(0, args[0])));
+        return;
+    }
+    if (step.op == "forks") {
+        tree.static_tree().set_fork_depth(args[0]);
+        return;
+    }
+    if (step.op == "compact" || step.op == "compact_veb") {
+        tree.static_tree().compact(step.op == "compact" ? NodeLayout::InOrder : NodeLayout::VanEmdeBoas);
+        return;
+    }
 
-    remove_with_message(tree, 9);
-    print_size(tree);
+    OutputLock lock;
+    if (step.op == "echo") {
+        std::cout << step.text << std::endl;
+    } else if (step.op == "print") {
+        pretty_print_with_header(tree);
+    } else if (step.op == "insert") {
+        insert_with_message(tree, args[0]);
+    } else if (step.op == "remove") {
+        remove_with_message(tree, args[0]);
+    } else if (step.op == "contains") {
+        contains_with_message(tree, args[0]);
+    } else if (step.op == "head") {
+        check_and_remove_head_with_message(tree, args[0]);
+    } else if (step.op == "size") {
+        print_size(tree);
+    } else if (step.op == "verify") {
+        verify_with_message(tree);
+    } else if (step.op == "find_or_insert") {
+        find_or_insert_with_message(tree.static_tree(), args[0]);
+    } else if (step.op == "hint_insert") {
+        hint_insert_with_message(tree.static_tree(), hint, args[0]);
+    } else if (step.op == "foreign_hint") {
+        foreign_hint_with_message<Tree>(args[0]);
+    } else if (step.op == "reborn_hint") {
+        reborn_hint_with_message<Tree>(args[0]);
+    } else if (step.op == "min" || step.op == "max") {
+        print_end(tree.static_tree(), step.op == "min");
+    } else if (step.op == "pop_min" || step.op == "pop_max") {
+        pop_with_message(tree.static_tree(), step.op == "pop_min");
+    } else if (step.op == "drain_min" || step.op == "drain_max") {
+        drain_with_message(tree.static_tree(), step.op == "drain_min");
+    } else if (step.op == "sum") {
+        sum_with_message(tree.static_tree(), args[0], args[1]);
+    } else if (step.op == "cache_stats") {
+        print_lookup_cache_stats(tree.static_tree().lookup_cache_stats());
+    } else if (step.op == "memory") {
+        print_memory_usage(tree.static_tree().memory_usage(), sizeof(typename Tree::node_type));
+    }
+}
 
-    remove_with_message(tree, 4);
-    print_size(tree);
+// Whether `step` walks the tree's nodes (as opposed to only loading numbers
+// or printing the size or memory usage).
+bool reads_nodes(const Step &step) {
+    return step.op == "print" || step.op == "verify" || step.op == "insert" || step.op == "remove" ||
+           step.op == "contains" || step.op == "head" || step.op == "hint_insert" ||
+           step.op.compare(0, 4, "pop_") == 0 || step.op.compare(0, 6, "drain_") == 0 || step.op == "stab" ||
+           step.op == "overlap" || step.op == "stab_check" || step.op == "overlap_check" ||
+           step.op == "interval_insert" || step.op == "interval_remove" || step.op == "interval_contains" ||
+           step.op == "interval_verify";
+}
 
-    remove_with_message(tree, 10);
-    print_size(tree);
+// Runs every step of `scenario` on a new `Tree`, including destroying it. If
+// `compact_before_reads` is true, the tree is compacted before each step that
+// walks its nodes, switching between the two layouts. If `cache_slots` isn't
+// 0, the tree starts with a lookup cache that big. Neither may change any
+// output.
+template <typename Tree, bool compact_before_reads = false, size_t cache_slots = 0>
+void run_steps(const Scenario &scenario) {
+    AVLAdapter<Tree> tree;
+    typename Tree::Handle hint;
+    tree.static_tree().enable_lookup_cache(cache_slots);
+    bool van_emde_boas = false;
+    for (const Step &step : scenario.steps) {
+        if (compact_before_reads && reads_nodes(step)) {
+            tree.static_tree().compact(van_emde_boas ? NodeLayout::VanEmdeBoas : NodeLayout::InOrder);
+            van_emde_boas = !van_emde_boas;
+        }
+        run_step(tree, hint, step);
+    }
+}
 
-    remove_with_message(tree, 9);
-    print_size(tree);
+// The same for an interval scenario, on a new `IntervalTree`.
+template <bool compact_before_reads = false>
+void run_interval_steps(const Scenario &scenario) {
+    IntervalTree intervals;
+    bool van_emde_boas = false;
+    for (const Step &step : scenario.steps) {
+        if (compact_before_reads && reads_nodes(step)) {
+            intervals.compact(van_emde_boas ? NodeLayout::VanEmdeBoas : NodeLayout::InOrder);
+            van_emde_boas = !van_emde_boas;
+        }
+        run_interval_step(intervals, step);
+    }
+}
 
-    std::cout << "\nClearing the tree..." << std::endl;
-    tree.clear();
-    print_size(tree);
+// -------------------- VARIANTS --------------------
+
+// Every tree the scenarios are run against. Interval scenarios only run
+// against the variants with `intervals` set, and the rest only against the
+// others.
+struct Variant {
+    std::string name;
+    std::function<void(const Scenario &)> run;
+    bool intervals = false;
+};
+
+std::vector<Variant> variants() {
+    return {
+        {"AVLTree", run_steps<AVLTree>},
+        {"AVLTree compacted", run_steps<AVLTree, true>},
+        {"AVLTree cached", run_steps<AVLTree, false, 16>},
+        {"AugmentedAVLTree<SumMonoid>", run_steps<AugmentedAVLTree<SumMonoid>>},
+        {"AugmentedAVLTree<MinMonoid> compacted", run_steps<AugmentedAVLTree<MinMonoid>, true>},
+        {"IntervalTree", run_interval_steps<>, true},
+        {"IntervalTree compacted", run_interval_steps<true>, true},
+    };
 }
 
-void test18() {
-    std::cout << "--- Test 18 output ---\n" << std::endl;
+// -------------------- RUNNER --------------------
+
+struct Result {
+    bool passed = false;
+    double milliseconds = 0;       // not counting `wait_milliseconds`
+    double wait_milliseconds = 0;  // spent waiting for `output_mutex`
+    std::string output;
+    std::string message;
+};
+
+std::string read_file(const std::string &path, bool &ok) {
+    std::ifstream file(path, std::ios::binary);
+    ok = static_cast<bool>(file);
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
 
-    AVL tree;
+// Describes the first line where `actual` differs from `expected`.
+std::string first_difference(const std::string &expected, const std::string &actual) {
+    std::istringstream expected_lines(expected);
+    std::istringstream actual_lines(actual);
+    std::string expected_line;
+    std::string actual_line;
+    for (int line = 1;; ++line) {
+        bool has_expected = static_cast<bool>(std::getline(expected_lines, expected_line));
+        bool has_actual = static_cast<bool>(std::getline(actual_lines, actual_line));
+        if (!has_expected && !has_actual) {
+            return "output differs only in trailing newlines";
+        }
+        if (!has_expected || !has_actual || expected_line != actual_line) {
+            return "line " + std::to_string(line) + ":\n    expected: " +
+                   (has_expected ? "\"" + expected_line + "\"" : "end of output") + "\n    actual:   " +
+                   (has_actual ? "\"" + actual_line + "\"" : "end of output");
+        }
+    }
+}
 
-    pretty_print_with_header(tree);
+Result run_scenario(const Scenario &scenario, const Variant &variant) {
+    Result result;
+
+    captured_output = &result.output;
+    output_wait = {};
+    auto start = std::chrono::steady_clock::now();
+    variant.run(scenario);
+    auto end = std::chrono::steady_clock::now();
+    captured_output = nullptr;
+
+    result.wait_milliseconds = std::chrono::duration<double, std::milli>(output_wait).count();
+    result.milliseconds = std::chrono::duration<double, std::milli>(end - start - output_wait).count();
+
+    bool ok = false;
+    std::string expected = read_file(scenario.golden_path, ok);
+    if (!ok) {
+        result.message = "cannot open " + scenario.golden_path;
+    } else if (expected != result.output) {
+        result.message = first_difference(expected, result.output);
+    } else {
+        result.passed = true;
+    }
+    return result;
+}
 
-    std::cout << "\nInserting 1, 2, and 3 into the tree..." << std::endl;
-    tree.insert(1);
-    tree.insert(2);
-    tree.insert(3);
+// Turns a command-line test name into the path of its scenario script.
+std::filesystem::path scenario_path(const std::string &test, const std::filesystem::path &dir) {
+    if (!test.empty() && std::all_of(test.begin(), test.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+        return dir / "scenarios" / ("test" + test + ".txt");
+    }
+    return test;
+}
 
-    pretty_print_with_header(tree);
+// Lists every scenario in `dir`/scenarios, with test2 before test10.
+std::vector<std::filesystem::path> all_scenarios(const std::filesystem::path &dir) {
+    std::vector<std::filesystem::path> paths;
+    std::error_code error;
+    for (const auto &entry : std::filesystem::directory_iterator(dir / "scenarios", error)) {
+        if (entry.path().extension() == ".txt") {
+            paths.push_back(entry.path());
+        }
+    }
+    auto key = [](const std::filesystem::path &path) {
+        std::string stem = path.stem().string();
+        size_t digits = stem.find_first_of("0123456789");
+        long number = digits == std::string::npos ? -1 : std::stol(stem.substr(digits));
+        return std::make_pair(stem.substr(0, digits), number);
+    };
+    std::sort(paths.begin(), paths.end(), [&](const auto &a, const auto &b) { return key(a) < key(b); });
+    return paths;
+}
 
-    std::cout << "\nClearing the tree..." << std::endl;
-    tree.clear();
+#ifndef AVL_LAB_DIR
+#define AVL_LAB_DIR "."
+#endif
 
-    pretty_print_with_header(tree);
+int usage(const char *program) {
+    std::cerr << "Usage: " << program << " [--jobs N] [--print] [--dir DIR] [TEST...]" << std::endl;
+    std::cerr << "where TEST is a test number, the path to a scenario script, or all (the default)" << std::endl;
+    return 1;
 }
 
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        std::cerr << "Usage: " << argv[0] << " [TEST]" << std::endl;
-        std::cerr << "where TEST is in the range of 1-18 or all" << std::endl;
-        return 1;
+    std::filesystem::path dir = AVL_LAB_DIR;
+    unsigned jobs = 1;
+    bool print = false;
+    std::vector<std::string> tests;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--jobs" && i + 1 < argc) {
+            jobs = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+        } else if (arg == "--print") {
+            print = true;
+        } else if (arg == "--dir" && i + 1 < argc) {
+            dir = argv[++i];
+        } else if (!arg.empty() && arg[0] == '-') {
+            return usage(argv[0]);
+        } else {
+            tests.push_back(arg);
+        }
     }
 
-    std::string test = argv[1];
-
-    if (test == "1") {
-        test1();
-    } else if (test == "2") {
-        test2();
-    } else if (test == "3") {
-        test3();
-    } else if (test == "4") {
-        test4();
-    } else if (test == "5") {
-        test5();
-    } else if (test == "6") {
-        test6();
-    } else if (test == "7") {
-        test7();
-    } else if (test == "8") {
-        test8();
-    } else if (test == "9") {
-        test9();
-    } else if (test == "10") {
-        test10();
-    } else if (test == "11") {
-        test11();
-    } else if (test == "12") {
-        test12();
-    } else if (test == "13") {
-        test13();
-    } else if (test == "14") {
-        test14();
-    } else if (test == "15") {
-        test15();
-    } else if (test == "16") {
-        test16();
-    } else if (test == "17") {
-        test17();
-    } else if (test == "18") {
-        test18();
-    } else if (test == "all") {
-        test1();
-
-        std::cout << "\n\n";
-        test2();
-
-        std::cout << "\n\n";
-        test3();
-
-        std::cout << "\n\n";
-        test4();
-
-        std::cout << "\n\n";
-        test5();
-
-        std::cout << "\n\n";
-        test6();
-
-        std::cout << "\n\n";
-        test7();
-
-        std::cout << "\n\n";
-        test8();
-
-        std::cout << "\n\n";
-        test9();
-
-        std::cout << "\n\n";
-        test10();
-
-        std::cout << "\n\n";
-        test11();
-
-        std::cout << "\n\n";
-        test12();
-
-        std::cout << "\n\n";
-        test13();
-
-        std::cout << "\n\n";
-        test14();
-
-        std::cout << "\n\n";
-        test15();
-
-        std::cout << "\n\n";
-        test16();
-
-        std::cout << "\n\n";
-        test17();
-
-        std::cout << "\n\n";
-        test18();
+    std::vector<std::filesystem::path> paths;
+    if (tests.empty() || (tests.size() == 1 && tests[0] == "all")) {
+        paths = all_scenarios(dir);
     } else {
-        std::cerr << test << " is not a valid test to run. The valid options are any number in the range 1-18 and all"
-                  << std::endl;
+        for (const std::string &test : tests) {
+            paths.push_back(scenario_path(test, dir));
+        }
+    }
+    if (paths.empty()) {
+        std::cerr << "No scenarios found in " << (dir / "scenarios").string() << std::endl;
         return 1;
     }
 
-    return 0;
+    std::vector<Scenario> scenarios(paths.size());
+    for (size_t i = 0; i < paths.size(); ++i) {
+        std::string error;
+        if (!parse_scenario(paths[i], dir, scenarios[i], error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+    }
+
+    // One job per matching (scenario, variant) pair, handed out to the worker
+    // threads in order.
+    std::vector<Variant> all_variants = variants();
+    std::vector<std::pair<const Scenario *, const Variant *>> pairs;
+    for (const Scenario &scenario : scenarios) {
+        for (const Variant &variant : all_variants) {
+            if (scenario.intervals == variant.intervals) {
+                pairs.emplace_back(&scenario, &variant);
+            }
+        }
+    }
+    size_t job_count = pairs.size();
+    std::vector<Result> results(job_count);
+    std::atomic<size_t> next_job{0};
+
+    CaptureBuffer capture(std::cout.rdbuf());
+    std::streambuf *original = std::cout.rdbuf(&capture);
+
+    auto worker = [&] {
+        for (size_t job = next_job++; job < job_count; job = next_job++) {
+            results[job] = run_scenario(*pairs[job].first, *pairs[job].second);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned i = 1; i < std::min<size_t>(jobs, job_count); ++i) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : workers) {
+        thread.join();
+    }
+
+    std::cout.rdbuf(original);
+
+    int failures = 0;
+    double total_milliseconds = 0;
+    for (size_t job = 0; job < job_count; ++job) {
+        const Scenario &scenario = *pairs[job].first;
+        const Variant &variant = *pairs[job].second;
+        const Result &result = results[job];
+        total_milliseconds += result.milliseconds;
+
+        if (print) {
+            std::cout << result.output;
+        }
+        std::cout << (result.passed ? "PASS " : "FAIL ") << scenario.name << " [" << variant.name << "] "
+                  << std::fixed << std::setprecision(3) << result.milliseconds << " ms";
+        if (result.wait_milliseconds > 0) {
+            std::cout << " (+" << result.wait_milliseconds << " ms waiting for output)";
+        }
+        std::cout << std::endl;
+        if (!result.passed) {
+            ++failures;
+            std::cout << "  " << result.message << std::endl;
+        }
+    }
+
+    std::cout << job_count - failures << " of " << job_count << " passed in " << std::fixed << std::setprecision(3)
+              << total_milliseconds << " ms" << std::endl;
+    return failures == 0 ? 0 : 1;
 }